@@ -0,0 +1,345 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "attach.h"
+
+static char buffer[ATTACH_BUFFER_SIZE];
+
+// Adds v to *sum, which stays -1 once anything is unavailable
+static void attach_add(long *sum, long v) {
+    if (*sum >= 0)
+        *sum = v < 0 ? -1 : *sum + v;
+}
+
+// What a thread's count went up by, never less than 0, all of it for a
+// thread that wasn't there last time, or -1 if it's unavailable
+static long attach_thread_delta(
+    const struct attach_thread *last,
+    long before,
+    long after) {
+    if (last == NULL)
+        return after;
+    if (before < 0 || after < 0)
+        return -1;
+    return after > before ? after - before : 0;
+}
+
+// Reads each of pid's threads' context switches and schedstats, summing
+// what they went up by since the last reading into t, and calls fn for
+// each thread if it isn't NULL
+static int attach_tasks(
+    struct attach *at,
+    struct attach_totals *t,
+    int (*fn)(struct attach *, pid_t, struct error_buffer *),
+    struct error_buffer *errbuf) {
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%i/task", at->pid);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        t->nvcsw = t->nivcsw = -1;
+        t->procstat.sched_runtime = t->procstat.sched_delay = -1;
+        t->procstat.sched_slices = -1;
+        return 0;
+    }
+
+    int n = 0, max = at->nthreads > 0 ? at->nthreads : 16;
+    struct attach_thread *threads = malloc(max * sizeof(struct attach_thread));
+    if (threads == NULL)
+        goto nomem;
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        pid_t tid = atoi(ent->d_name);
+        if (tid <= 0)
+            continue;
+        if (fn != NULL && fn(at, tid, errbuf) < 0) {
+            closedir(dir);
+            free(threads);
+            return -1;
+        }
+        if (n == max) {
+            struct attach_thread *more =
+                realloc(threads, 2 * max * sizeof(struct attach_thread));
+            if (more == NULL)
+                goto nomem;
+            threads = more;
+            max *= 2;
+        }
+
+        struct procstat task;
+        snprintf(path, sizeof(path), "/proc/%i/task/%i", at->pid, tid);
+        procstat_read_dir(&task, path);
+        struct attach_thread *th = &threads[n++];
+        th->tid           = tid;
+        th->nvcsw         = task.nvcsw;
+        th->nivcsw        = task.nivcsw;
+        th->sched_runtime = task.sched_runtime;
+        th->sched_delay   = task.sched_delay;
+        th->sched_slices  = task.sched_slices;
+
+        // threads mostly come in the same order each time
+        const struct attach_thread *l = NULL;
+        if (n - 1 < at->nthreads && at->threads[n - 1].tid == tid)
+            l = &at->threads[n - 1];
+        for (int j=0; l == NULL && j<at->nthreads; j++)
+            if (at->threads[j].tid == tid)
+                l = &at->threads[j];
+
+        attach_add(&t->nvcsw,
+            attach_thread_delta(l, l ? l->nvcsw : 0, th->nvcsw));
+        attach_add(&t->nivcsw,
+            attach_thread_delta(l, l ? l->nivcsw : 0, th->nivcsw));
+        attach_add(&t->procstat.sched_runtime, attach_thread_delta(l,
+            l ? l->sched_runtime : 0, th->sched_runtime));
+        attach_add(&t->procstat.sched_delay, attach_thread_delta(l,
+            l ? l->sched_delay : 0, th->sched_delay));
+        attach_add(&t->procstat.sched_slices, attach_thread_delta(l,
+            l ? l->sched_slices : 0, th->sched_slices));
+    }
+    closedir(dir);
+
+    free(at->threads);
+    at->threads  = threads;
+    at->nthreads = n;
+    return 0;
+
+nomem:
+    closedir(dir);
+    free(threads);
+    strncpy(errbuf->s, "malloc() failed", errbuf->n);
+    return -1;
+}
+
+// Reads pid's totals into t, calling fn for each thread; returns 0 if the
+// process has gone
+static int attach_totals(
+    struct attach *at,
+    struct attach_totals *t,
+    int (*fn)(struct attach *, pid_t, struct error_buffer *),
+    struct error_buffer *errbuf) {
+
+    memset(t, 0, sizeof(struct attach_totals));
+
+    // the command name may have spaces or parentheses of its own
+    char *p;
+    if (procstat_file(buffer, sizeof(buffer), "/proc/%i/stat", at->pid) < 0 ||
+        (p = strrchr(buffer, ')')) == NULL)
+        return 0;
+    char state;
+    long cminflt, cmajflt, cutime, cstime;
+    if (sscanf(p + 2, "%c %*d %*d %*d %*d %*d %*u %ld %ld %ld %ld %ld %ld "
+               "%ld %ld", &state, &t->minflt, &cminflt, &t->majflt,
+               &cmajflt, &t->utime, &t->stime, &cutime, &cstime) != 9) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to parse /proc/%i/stat", at->pid);
+        return -1;
+    }
+    t->minflt += cminflt;
+    t->majflt += cmajflt;
+    t->utime  += cutime;
+    t->stime  += cstime;
+    if (state == 'Z' || state == 'X')
+        at->exited = 1;
+
+    // io, and the main thread's context switches, with schedstats to be
+    // summed over every thread instead
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%i", at->pid);
+    procstat_read_dir(&t->procstat, path);
+    t->procstat.sched_runtime = t->procstat.sched_delay = 0;
+    t->procstat.sched_slices = 0;
+
+    // a zombie no longer has any memory
+    if (procstat_file(buffer, sizeof(buffer), "/proc/%i/status", at->pid) >= 0)
+        t->rss = procstat_key(buffer, "VmRSS");
+    if (t->rss < 0)
+        t->rss = 0;
+
+    if (attach_tasks(at, t, fn, errbuf) < 0)
+        return -1;
+
+    // the counts summed are only as complete as the least counted thread's
+    for (int i=0; i<PERF_NCOUNTERS; i++)
+        t->perf[i] = at->ntasks > 0 ? 0 : -1;
+    t->perf_scale = -1;
+    for (int j=0; j<at->ntasks; j++) {
+        if (perf_read(&at->counters[j], errbuf) < 0)
+            return -1;
+        for (int i=0; i<PERF_NCOUNTERS; i++)
+            attach_add(&t->perf[i], at->counters[j].count[i]);
+        if (t->perf_scale < 0 || at->counters[j].scale < t->perf_scale)
+            t->perf_scale = at->counters[j].scale;
+    }
+
+    return 1;
+}
+
+static int attach_perf(
+    struct attach *at,
+    pid_t tid,
+    struct error_buffer *errbuf) {
+
+    if (at->perf_partial)
+        return 0;
+
+    if (at->ntasks == at->maxtasks) {
+        int max = at->maxtasks > 0 ? 2 * at->maxtasks : 16;
+        struct perf_counters *more =
+            realloc(at->counters, max * sizeof(struct perf_counters));
+        if (more == NULL)
+            goto partial;
+        at->counters = more;
+        at->maxtasks = max;
+    }
+
+    if (perf_attach_running(&at->counters[at->ntasks], tid, errbuf) == 0) {
+        at->ntasks++;
+        return 0;
+    }
+    // counters left open by a failed attach are closed too
+    perf_close(&at->counters[at->ntasks]);
+
+    // a thread that exited in the meantime has nothing more to count
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%i/task/%i", at->pid, tid);
+    if (access(path, F_OK) < 0)
+        return 0;
+
+    // out of file descriptors, most likely
+partial:
+    for (int j=0; j<at->ntasks; j++)
+        perf_close(&at->counters[j]);
+    at->ntasks = 0;
+    at->perf_partial = 1;
+    return 0;
+}
+
+// Raises the soft limit on open files to the hard limit, for perf counters
+static void attach_raise_nofile(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+int attach_setup(
+    struct attach *at,
+    pid_t pid,
+    int perf,
+    struct error_buffer *errbuf) {
+
+    at->pid          = pid;
+    at->exited       = 0;
+    at->nthreads     = 0;
+    at->threads      = NULL;
+    at->perf_partial = 0;
+    at->ntasks       = 0;
+    at->maxtasks     = 0;
+    at->counters     = NULL;
+    if (perf)
+        attach_raise_nofile();
+
+    int r = attach_totals(at, &at->last, perf ? attach_perf : NULL, errbuf);
+    if (r < 0)
+        return -1;
+    if (r == 0 || at->exited) {
+        snprintf(errbuf->s, errbuf->n, "no running process %i", pid);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &at->when);
+    return 0;
+}
+
+// after - before, or -1 if either is unavailable
+static long attach_delta(long before, long after) {
+    return before < 0 || after < 0 ? -1 : after - before;
+}
+
+static void attach_ticks(struct timeval *tv, long ticks) {
+    long usec = ticks * (1000000L / sysconf(_SC_CLK_TCK));
+    tv->tv_sec  = usec / 1000000L;
+    tv->tv_usec = usec % 1000000L;
+}
+
+int attach_sample(
+    struct attach *at,
+    struct program_result *res,
+    struct error_buffer *errbuf) {
+
+    struct attach_totals t;
+    int r = attach_totals(at, &t, NULL, errbuf);
+    if (r <= 0)
+        return r;
+
+    const struct attach_totals *l = &at->last;
+    res->start = at->when;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &res->end);
+    at->when = res->end;
+
+    struct rusage *ru = &res->rusage;
+    attach_ticks(&ru->ru_utime, t.utime - l->utime);
+    attach_ticks(&ru->ru_stime, t.stime - l->stime);
+    ru->ru_maxrss  = t.rss;
+    ru->ru_minflt  = t.minflt - l->minflt;
+    ru->ru_majflt  = t.majflt - l->majflt;
+    ru->ru_nvcsw   = t.nvcsw;
+    ru->ru_nivcsw  = t.nivcsw;
+
+    struct procstat *ps = &res->procstat;
+    const struct procstat *a = &t.procstat, *b = &l->procstat;
+    ps->sched_runtime  = a->sched_runtime;
+    ps->sched_delay    = a->sched_delay;
+    ps->sched_slices   = a->sched_slices;
+    ps->io_read_bytes  = attach_delta(b->io_read_bytes, a->io_read_bytes);
+    ps->io_write_bytes = attach_delta(b->io_write_bytes, a->io_write_bytes);
+    ps->io_syscr       = attach_delta(b->io_syscr, a->io_syscr);
+    ps->io_syscw       = attach_delta(b->io_syscw, a->io_syscw);
+    ps->nvcsw          = attach_delta(b->nvcsw, a->nvcsw);
+    ps->nivcsw         = attach_delta(b->nivcsw, a->nivcsw);
+    ru->ru_inblock = ps->io_read_bytes < 0 ? 0 : ps->io_read_bytes / 512;
+    ru->ru_oublock = ps->io_write_bytes < 0 ? 0 : ps->io_write_bytes / 512;
+
+    for (int i=0; i<PERF_NCOUNTERS; i++)
+        res->perf.count[i] = attach_delta(l->perf[i], t.perf[i]);
+    res->perf.scale = t.perf_scale;
+
+    at->last = t;
+    return 1;
+}
+
+void attach_close(struct attach *at) {
+    for (int j=0; j<at->ntasks; j++)
+        perf_close(&at->counters[j]);
+    free(at->counters);
+    at->counters = NULL;
+    free(at->threads);
+    at->threads  = NULL;
+    at->nthreads = 0;
+    at->ntasks = at->maxtasks = 0;
+}
@@ -0,0 +1,115 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ATTACH_H
+#define _ATTACH_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "error.h"
+#include "perf.h"
+#include "program.h"
+
+// Measuring a process that's already running, rather than a command that
+// measure runs and waits for: every interval its totals are read from
+// /proc/<pid> (stat, status and io, and each thread's status and
+// schedstat), and what they went up by since the last reading fills in a
+// program_result, as if the interval had been a run, so that intervals
+// are recorded with the same fields as runs:
+//   start, end     the interval
+//   utime, stime   cpu time, including children it has reaped
+//   maxrss         resident set size at the end of the interval (kB)
+//   minflt, majflt faults, including children it has reaped
+//   inblock, oublock  storage I/O in 512 byte blocks, from io
+//   nvcsw, nivcsw  context switches, summed over its threads
+// and the procstat fields (see procstat.h), summed over its threads, and
+// perf counters if wanted, attached to each of its threads (any started
+// later being counted by the counters of the thread that started them).
+// Context switches and schedstats are kept per thread, and an interval
+// sums what went up for each thread read both times, clamped at 0, and all
+// of what a thread started since has, so that threads exiting don't take
+// what they did before from the totals; what they did in their last
+// interval is lost though.
+//
+// Each thread takes a file descriptor per perf counter, so with perf the
+// open file limit is first raised as far as it goes; if some thread still
+// can't be given counters, none are kept, the perf fields being left
+// unavailable rather than counting only some threads, and perf_partial is
+// set.
+
+#define ATTACH_BUFFER_SIZE 8192
+
+// Default interval, in ns
+#define ATTACH_INTERVAL 1000000000L
+
+struct attach_totals {
+    long utime;             // ticks
+    long stime;
+    long minflt;
+    long majflt;
+    long rss;               // kB
+    long nvcsw;             // since the last reading, over all threads
+    long nivcsw;
+    struct procstat procstat; // sched_* too since the last reading
+    long perf[PERF_NCOUNTERS];
+    long perf_scale;        // the least over all threads
+};
+
+// A thread's context switches and schedstats, as of the last reading
+struct attach_thread {
+    pid_t tid;
+    long nvcsw;
+    long nivcsw;
+    long sched_runtime;
+    long sched_delay;
+    long sched_slices;
+};
+
+struct attach {
+    pid_t pid;
+    int exited;             // found a zombie, or gone
+    struct timespec when;   // of the last reading
+    struct attach_totals last;
+    int nthreads;           // as of the last reading
+    struct attach_thread *threads;
+    int perf_partial;       // perf wanted, but not every thread got it
+    int ntasks;             // with perf counters, if any
+    int maxtasks;
+    struct perf_counters *counters;
+};
+
+// Attaches to pid, with perf counters on each of its threads if perf is
+// set, and takes the first reading.
+int attach_setup(
+    struct attach *at,
+    pid_t pid,
+    int perf,
+    struct error_buffer *errbuf);
+
+// Takes a reading, putting what went up since the last into res; returns
+// 0 if the process has gone, in which case res is left alone, otherwise
+// 1 (at->exited being set if this is its last).
+int attach_sample(
+    struct attach *at,
+    struct program_result *res,
+    struct error_buffer *errbuf);
+
+void attach_close(struct attach *at);
+
+#endif // _ATTACH_H
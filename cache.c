@@ -0,0 +1,170 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "record.h"
+
+#define CACHE_DROP_PATH "/proc/sys/vm/drop_caches"
+#define CACHE_BUFFER_SIZE 65536
+
+int cache_parse(
+    struct cache *cache,
+    const char *arg,
+    struct error_buffer *errbuf) {
+
+    if (strcmp(arg, "cold") == 0) {
+        cache->mode = CACHE_COLD;
+    } else if (strcmp(arg, "cold:drop") == 0) {
+        cache->mode = CACHE_COLD;
+        cache->drop = 1;
+    } else if (strcmp(arg, "warm") == 0) {
+        cache->mode = CACHE_WARM;
+    } else {
+        snprintf(errbuf->s, errbuf->n,
+            "unknown cache mode \"%s\", expected cold, cold:drop or warm",
+            arg);
+        return -1;
+    }
+    return 0;
+}
+
+int cache_add(
+    struct cache *cache,
+    const char *path,
+    struct error_buffer *errbuf) {
+
+    if (cache->nfiles >= CACHE_MAX_FILES) {
+        snprintf(errbuf->s, errbuf->n,
+            "too many cache files, at most %i", CACHE_MAX_FILES);
+        return -1;
+    }
+    cache->files[cache->nfiles++] = path;
+    return 0;
+}
+
+static int cache_drop(void) {
+    sync();
+    int fd = open(CACHE_DROP_PATH, O_WRONLY);
+    if (fd < 0)
+        return -1;
+    int r = write(fd, "1", 1) == 1 ? 0 : -1;
+    close(fd);
+    return r;
+}
+
+void cache_setup(struct cache *cache) {
+    if (cache->mode == CACHE_COLD && cache->drop && cache_drop() < 0) {
+        cache->drop = 0;
+        cache->dropdenied = 1;
+    }
+}
+
+static int cache_evict(
+    int fd,
+    const char *path,
+    struct error_buffer *errbuf) {
+
+    // dirty pages can't be dropped, such as those of a freshly buffered
+    // stdin
+    if (fdatasync(fd) < 0 && errno != EINVAL) {
+        snprintf(errbuf->s, errbuf->n,
+            "fdatasync() failed for %s, %s", path, strerror(errno));
+        return -1;
+    }
+    int err = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (err != 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "posix_fadvise() failed for %s, %s", path, strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+static int cache_preread(
+    int fd,
+    const char *path,
+    struct error_buffer *errbuf) {
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+
+    static char buffer[CACHE_BUFFER_SIZE];
+    for (;;) {
+        ssize_t got = read(fd, buffer, CACHE_BUFFER_SIZE);
+        if (got == 0) break;
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            snprintf(errbuf->s, errbuf->n,
+                "read() failed for %s, %s", path, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int cache_prepare(
+    struct cache *cache,
+    struct error_buffer *errbuf) {
+
+    if (cache->mode == CACHE_ANY)
+        return 0;
+
+    if (cache->drop && cache_drop() < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to write %s, %s", CACHE_DROP_PATH, strerror(errno));
+        return -1;
+    }
+
+    for (int i=0; i<cache->nfiles; i++) {
+        int fd = open(cache->files[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            snprintf(errbuf->s, errbuf->n, "open() failed for %s, %s",
+                cache->files[i], strerror(errno));
+            return -1;
+        }
+        int r = cache->mode == CACHE_COLD
+            ? cache_evict(fd, cache->files[i], errbuf)
+            : cache_preread(fd, cache->files[i], errbuf);
+        close(fd);
+        if (r < 0)
+            return -1;
+    }
+    return 0;
+}
+
+void cache_info(
+    const struct cache *cache,
+    struct record_schema *schema) {
+
+    if (cache->mode == CACHE_ANY)
+        return;
+
+    record_info(schema, "cache=%s",
+        cache->mode == CACHE_COLD ? "cold" : "warm");
+    if (cache->drop)
+        record_info(schema, "cache_drop=true");
+    else if (cache->dropdenied)
+        record_info(schema, "cache_drop=denied");
+    for (int i=0; i<cache->nfiles; i++)
+        record_info(schema, "cache_file[%i]=%s", i, cache->files[i]);
+}
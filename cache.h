@@ -0,0 +1,72 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include "error.h"
+
+// Puts the page cache into a known state before each run: cold evicts the
+// command's input files so that each run reads them from disk, warm reads
+// them in so that none does.
+
+struct record_schema;
+
+#define CACHE_ANY  0 // leave the page cache be
+#define CACHE_COLD 1
+#define CACHE_WARM 2
+
+#define CACHE_MAX_FILES 64
+
+struct cache {
+    int mode;              // CACHE_*
+    int drop;              // also drop the whole page cache when cold
+    int dropdenied;        // ...but weren't allowed to
+    unsigned int nfiles;
+    const char *files[CACHE_MAX_FILES];
+};
+
+#define cache_init() {CACHE_ANY, 0, 0, 0, {NULL}}
+
+// Parses a cache mode, one of "cold", "cold:drop" or "warm"
+int cache_parse(
+    struct cache *cache,
+    const char *arg,
+    struct error_buffer *errbuf);
+
+// Adds an input file to evict or pre-read
+int cache_add(
+    struct cache *cache,
+    const char *path,
+    struct error_buffer *errbuf);
+
+// Checks that the whole page cache may be dropped if asked to, clearing
+// drop and setting dropdenied if not
+void cache_setup(struct cache *cache);
+
+// Evicts or pre-reads the input files, to be called before each run
+int cache_prepare(
+    struct cache *cache,
+    struct error_buffer *errbuf);
+
+// Describes the cache mode with info lines
+void cache_info(
+    const struct cache *cache,
+    struct record_schema *schema);
+
+#endif // _CACHE_H
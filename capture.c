@@ -0,0 +1,623 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "capture.h"
+
+// Only capture_pump(), on the main thread, reads into and encodes through
+// these, pumping each capture to completion, so every capture shares them;
+// with --pipeline the worker thread only materializes and discards
+// captures, and must not reach the codec
+#define CAPTURE_BUFSIZE 65536
+static unsigned char inbuf[CAPTURE_BUFSIZE];
+static unsigned char outbuf[CAPTURE_BUFSIZE];
+
+int capture_codec_parse(
+    const char *name,
+    int *codec,
+    struct error_buffer *errbuf) {
+
+    if (strcmp(name, "gzip") == 0) {
+        *codec = CAPTURE_CODEC_GZIP;
+        return 0;
+    }
+    if (strcmp(name, "zstd") == 0) {
+#ifdef WITH_ZSTD
+        *codec = CAPTURE_CODEC_ZSTD;
+        return 0;
+#else
+        strncpy(errbuf->s, "not built with zstd support", errbuf->n);
+        return -1;
+#endif
+    }
+    snprintf(errbuf->s, errbuf->n, "unknown compression codec \"%s\"", name);
+    return -1;
+}
+
+int capture_mode_parse(
+    const char *arg,
+    struct capture_spec *spec,
+    struct error_buffer *errbuf) {
+
+    if (strcmp(arg, "file") == 0) {
+        spec->mode = CAPTURE_MODE_FILE;
+        return 0;
+    }
+    if (strcmp(arg, "count") == 0) {
+        spec->mode = CAPTURE_MODE_COUNT;
+        return 0;
+    }
+    if (strcmp(arg, "hash") == 0) {
+        spec->mode = CAPTURE_MODE_HASH;
+        return 0;
+    }
+
+    int mode;
+    if (strncmp(arg, "head:", 5) == 0)
+        mode = CAPTURE_MODE_HEAD;
+    else if (strncmp(arg, "tail:", 5) == 0)
+        mode = CAPTURE_MODE_TAIL;
+    else {
+        snprintf(errbuf->s, errbuf->n, "unknown capture mode \"%s\"", arg);
+        return -1;
+    }
+
+    char *end;
+    long retain = strtol(arg + 5, &end, 10);
+    if (end == arg + 5 || *end != '\0' || retain <= 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "invalid byte count in capture mode \"%s\"", arg);
+        return -1;
+    }
+    spec->mode   = mode;
+    spec->retain = retain;
+    return 0;
+}
+
+int capture_active(const struct capture_spec *spec) {
+    return spec->mode != CAPTURE_MODE_FILE ||
+        spec->codec != CAPTURE_CODEC_NONE || spec->store != NULL ||
+        spec->memfd;
+}
+
+void capture_reset(struct capture *cap) {
+    memset(cap, 0, sizeof(struct capture));
+    cap->fd = cap->childfd = cap->outfd = cap->keepfd = -1;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        ssize_t wrote = write(fd, buf + off, len - off);
+        if (wrote < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        off += wrote;
+    }
+    return 0;
+}
+
+// Moves an in-memory output to an unnamed file in the template's
+// directory
+static int capture_spill(struct capture *cap, int *fd) {
+    char dir[PATH_MAX];
+    strncpy(dir, cap->template, PATH_MAX - 1);
+    dir[PATH_MAX - 1] = '\0';
+    char *slash = rindex(dir, '/');
+    if (slash != NULL)
+        *slash = '\0';
+    else
+        strcpy(dir, ".");
+
+    int tmpfd = open(dir, O_TMPFILE | O_WRONLY | O_CLOEXEC, S_IRUSR);
+    if (tmpfd < 0)
+        return -1;
+    off_t off = 0;
+    while (off < cap->outbytes) {
+        ssize_t n = sendfile(tmpfd, *fd, &off, cap->outbytes - off);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n == 0)
+                errno = EIO;
+            close(tmpfd);
+            return -1;
+        }
+    }
+    close(*fd);
+    *fd = tmpfd;
+    cap->inmemory = 0;
+    return 0;
+}
+
+// Writes to the output, spilling one in memory to disk once it would grow
+// past its limit
+static int output_write(struct capture *cap, const void *buf, size_t len) {
+    if (cap->inmemory && cap->outbytes + len > cap->spec->memlimit &&
+        capture_spill(cap, &cap->outfd) < 0)
+        return -1;
+    if (write_all(cap->outfd, buf, len) < 0)
+        return -1;
+    cap->outbytes += len;
+    return 0;
+}
+
+static int codec_init(
+    struct capture *cap,
+    struct error_buffer *errbuf) {
+
+    int level = cap->spec->level;
+    switch (cap->spec->codec) {
+    case CAPTURE_CODEC_NONE:
+        return 0;
+    case CAPTURE_CODEC_GZIP:
+        // 16 + MAX_WBITS asks zlib for a gzip wrapper
+        if (deflateInit2(&cap->z,
+                level < 0 ? Z_DEFAULT_COMPRESSION : level,
+                Z_DEFLATED, 16 + MAX_WBITS, 8,
+                Z_DEFAULT_STRATEGY) != Z_OK) {
+            strncpy(errbuf->s, "deflateInit2() failed", errbuf->n);
+            return -1;
+        }
+        return 0;
+#ifdef WITH_ZSTD
+    case CAPTURE_CODEC_ZSTD:
+        cap->zstd = ZSTD_createCStream();
+        if (cap->zstd == NULL) {
+            strncpy(errbuf->s, "ZSTD_createCStream() failed", errbuf->n);
+            return -1;
+        }
+        if (ZSTD_isError(ZSTD_initCStream(cap->zstd,
+                level < 0 ? ZSTD_CLEVEL_DEFAULT : level))) {
+            strncpy(errbuf->s, "ZSTD_initCStream() failed", errbuf->n);
+            return -1;
+        }
+        return 0;
+#endif
+    }
+    snprintf(errbuf->s, errbuf->n,
+        "unsupported capture codec %i", cap->spec->codec);
+    return -1;
+}
+
+static void codec_free(struct capture *cap) {
+    switch (cap->spec->codec) {
+    case CAPTURE_CODEC_NONE:
+        break;
+    case CAPTURE_CODEC_GZIP:
+        deflateEnd(&cap->z);
+        break;
+#ifdef WITH_ZSTD
+    case CAPTURE_CODEC_ZSTD:
+        ZSTD_freeCStream(cap->zstd);
+        cap->zstd = NULL;
+        break;
+#endif
+    }
+}
+
+// Compresses len bytes of data, finishing the stream if last is set
+static int codec_write(
+    struct capture *cap,
+    const void *data,
+    size_t len,
+    int last,
+    struct error_buffer *errbuf) {
+
+    switch (cap->spec->codec) {
+    case CAPTURE_CODEC_NONE:
+        if (output_write(cap, data, len) < 0)
+            goto write_failed;
+        return 0;
+    case CAPTURE_CODEC_GZIP: {
+        z_stream *z = &cap->z;
+        z->next_in  = (unsigned char *) data;
+        z->avail_in = len;
+        int ret;
+        do {
+            z->next_out  = outbuf;
+            z->avail_out = CAPTURE_BUFSIZE;
+            ret = deflate(z, last ? Z_FINISH : Z_NO_FLUSH);
+            if (ret == Z_STREAM_ERROR) {
+                strncpy(errbuf->s, "deflate() failed", errbuf->n);
+                return -1;
+            }
+            if (output_write(cap, outbuf,
+                    CAPTURE_BUFSIZE - z->avail_out) < 0)
+                goto write_failed;
+        } while (z->avail_out == 0 || (last && ret != Z_STREAM_END));
+        return 0;
+    }
+#ifdef WITH_ZSTD
+    case CAPTURE_CODEC_ZSTD: {
+        ZSTD_inBuffer in = {data, len, 0};
+        size_t remaining;
+        do {
+            ZSTD_outBuffer out = {outbuf, CAPTURE_BUFSIZE, 0};
+            remaining = last
+                ? ZSTD_compressStream2(cap->zstd, &out, &in, ZSTD_e_end)
+                : ZSTD_compressStream2(cap->zstd, &out, &in, ZSTD_e_continue);
+            if (ZSTD_isError(remaining)) {
+                snprintf(errbuf->s, errbuf->n, "zstd compression failed, %s",
+                    ZSTD_getErrorName(remaining));
+                return -1;
+            }
+            if (output_write(cap, outbuf, out.pos) < 0)
+                goto write_failed;
+        } while (in.pos < in.size || (last && remaining != 0));
+        return 0;
+    }
+#endif
+    }
+    return -1;
+
+write_failed:
+    snprintf(errbuf->s, errbuf->n,
+        "write of compressed output failed, %s", strerror(errno));
+    return -1;
+}
+
+static const char *codec_suffix(int codec) {
+    switch (codec) {
+    case CAPTURE_CODEC_GZIP: return ".gz";
+    case CAPTURE_CODEC_ZSTD: return ".zst";
+    }
+    return "";
+}
+
+// Creates the output file and starts its codec
+static int capture_output_open(
+    struct capture *cap,
+    struct error_buffer *errbuf) {
+
+    const struct capture_spec *spec = cap->spec;
+    const char *suffix = codec_suffix(spec->codec);
+    char *path = cap->buf;
+
+    if (spec->memfd) {
+        cap->outfd = memfd_create(cap->template, MFD_CLOEXEC);
+        if (cap->outfd < 0) {
+            snprintf(errbuf->s, errbuf->n, "memfd_create() failed, %s",
+                strerror(errno));
+            return -1;
+        }
+        cap->inmemory = 1;
+        cap->outbytes = 0;
+        return codec_init(cap, errbuf);
+    }
+
+    if (spec->store != NULL) {
+        if (store_tmp_template(spec->store, cap->template, suffix,
+                path, PATH_MAX, errbuf) < 0)
+            return -1;
+    } else if (snprintf(path, PATH_MAX, "%s%s", cap->template, suffix)
+               >= PATH_MAX) {
+        snprintf(errbuf->s, errbuf->n, "template too long, %s",
+            cap->template);
+        return -1;
+    }
+
+    cap->outfd = mkostemps(path, strlen(suffix), O_WRONLY | O_CLOEXEC);
+    if (cap->outfd < 0) {
+        snprintf(errbuf->s, errbuf->n, "mkstemps() failed for %s, %s",
+            cap->template, strerror(errno));
+        return -1;
+    }
+    *cap->path = path;
+
+    if (fchmod(cap->outfd, S_IRUSR) < 0) {
+        snprintf(errbuf->s, errbuf->n, "fchmod() failed for %s, %s",
+            path, strerror(errno));
+        return -1;
+    }
+
+    return codec_init(cap, errbuf);
+}
+
+// Replaces the output's path with the given hash
+static int capture_set_hash(
+    struct capture *cap,
+    const char *hash,
+    struct error_buffer *errbuf) {
+
+    strcpy(cap->buf, hash);
+    *cap->path = cap->buf;
+    return 0;
+}
+
+// Finishes the codec and closes the output, committing it to any store
+static int capture_output_close(
+    struct capture *cap,
+    struct error_buffer *errbuf) {
+
+    if (codec_write(cap, NULL, 0, 1, errbuf) < 0)
+        return -1;
+    codec_free(cap);
+
+    // kept unnamed until it's known whether the run is kept
+    if (cap->spec->memfd) {
+        cap->keepfd = cap->outfd;
+        cap->outfd = -1;
+        return 0;
+    }
+
+    int r = close(cap->outfd);
+    cap->outfd = -1;
+    if (r < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "close of captured output failed, %s", strerror(errno));
+        return -1;
+    }
+
+    if (cap->spec->store != NULL) {
+        char hash[SHA256_HEX_SIZE];
+        sha256_final_hex(&cap->hash, hash);
+        if (store_commit(cap->spec->store, *cap->path, hash,
+                codec_suffix(cap->spec->codec), errbuf) < 0)
+            return -1;
+        return capture_set_hash(cap, hash, errbuf);
+    }
+
+    return 0;
+}
+
+int capture_open(
+    struct capture *cap,
+    const struct capture_spec *spec,
+    const char *template,
+    const char **path,
+    char *buf,
+    struct error_buffer *errbuf) {
+
+    capture_reset(cap);
+    cap->spec     = spec;
+    cap->template = template;
+    cap->path     = path;
+    cap->buf      = buf;
+
+    switch (spec->mode) {
+    case CAPTURE_MODE_FILE:
+        sha256_init(&cap->hash);
+        if (capture_output_open(cap, errbuf) < 0)
+            return -1;
+        break;
+    case CAPTURE_MODE_HASH:
+        sha256_init(&cap->hash);
+        break;
+    case CAPTURE_MODE_HEAD:
+    case CAPTURE_MODE_TAIL:
+        cap->retained = malloc(spec->retain);
+        if (cap->retained == NULL) {
+            strncpy(errbuf->s, "malloc() failed", errbuf->n);
+            return -1;
+        }
+        break;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "pipe() failed, %s", strerror(errno));
+        return -1;
+    }
+    cap->fd      = fds[0];
+    cap->childfd = fds[1];
+
+    return 0;
+}
+
+void capture_forked(struct capture *cap) {
+    if (cap->childfd >= 0) {
+        close(cap->childfd);
+        cap->childfd = -1;
+    }
+}
+
+// Keeps the first or last spec->retain bytes of the stream
+static void capture_retain(
+    struct capture *cap,
+    const unsigned char *data,
+    size_t len) {
+
+    size_t retain = cap->spec->retain;
+    if (cap->spec->mode == CAPTURE_MODE_HEAD) {
+        if (cap->nretained < retain) {
+            size_t n = retain - cap->nretained;
+            if (n > len) n = len;
+            memcpy(cap->retained + cap->nretained, data, n);
+            cap->nretained += n;
+        }
+        return;
+    }
+
+    // the tail is kept in a ring, with each byte at its offset in the
+    // stream modulo retain; cap->bytes doesn't yet count data
+    size_t start = cap->bytes;
+    if (len >= retain) {
+        start += len - retain;
+        data  += len - retain;
+        len    = retain;
+    }
+    size_t off = start % retain;
+    size_t n = retain - off;
+    if (n > len) n = len;
+    memcpy(cap->retained + off, data, n);
+    memcpy(cap->retained, data + n, len - n);
+    cap->nretained += len;
+    if (cap->nretained > retain)
+        cap->nretained = retain;
+}
+
+// Writes out what was retained once the stream is finished
+static int capture_retained_write(
+    struct capture *cap,
+    struct error_buffer *errbuf) {
+
+    const unsigned char *data = cap->retained;
+    size_t len = cap->nretained, off = 0;
+    if (cap->spec->mode == CAPTURE_MODE_TAIL && len == cap->spec->retain)
+        off = cap->bytes % len;
+
+    sha256_init(&cap->hash);
+    sha256_update(&cap->hash, data + off, len - off);
+    sha256_update(&cap->hash, data, off);
+
+    if (capture_output_open(cap, errbuf) < 0 ||
+        codec_write(cap, data + off, len - off, 0, errbuf) < 0 ||
+        codec_write(cap, data, off, 0, errbuf) < 0)
+        return -1;
+    return capture_output_close(cap, errbuf);
+}
+
+int capture_pump(
+    struct capture *cap,
+    struct error_buffer *errbuf) {
+
+    ssize_t got = read(cap->fd, inbuf, CAPTURE_BUFSIZE);
+    if (got < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+            return 1;
+        snprintf(errbuf->s, errbuf->n,
+            "read from child output pipe failed, %s", strerror(errno));
+        return -1;
+    }
+
+    if (got > 0) {
+        switch (cap->spec->mode) {
+        case CAPTURE_MODE_FILE:
+            if (cap->spec->store != NULL)
+                sha256_update(&cap->hash, inbuf, got);
+            if (codec_write(cap, inbuf, got, 0, errbuf) < 0)
+                return -1;
+            break;
+        case CAPTURE_MODE_HASH:
+            sha256_update(&cap->hash, inbuf, got);
+            break;
+        case CAPTURE_MODE_HEAD:
+        case CAPTURE_MODE_TAIL:
+            capture_retain(cap, inbuf, got);
+            break;
+        }
+        cap->bytes += got;
+        return 1;
+    }
+
+    switch (cap->spec->mode) {
+    case CAPTURE_MODE_FILE:
+        return capture_output_close(cap, errbuf);
+    case CAPTURE_MODE_HASH: {
+        char hash[SHA256_HEX_SIZE];
+        sha256_final_hex(&cap->hash, hash);
+        return capture_set_hash(cap, hash, errbuf);
+    }
+    case CAPTURE_MODE_HEAD:
+    case CAPTURE_MODE_TAIL:
+        return capture_retained_write(cap, errbuf);
+    }
+    return 0;
+}
+
+// Fills the X's before the suffix of a template in with random characters
+static void capture_fill_template(char *path, size_t slen) {
+    static const char chars[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+    unsigned char r[6];
+    if (getrandom(r, sizeof(r), 0) != sizeof(r))
+        for (int i=0; i<sizeof(r); i++)
+            r[i] = rand();
+    char *x = path + strlen(path) - slen;
+    for (int i=0; i<6 && x > path && x[-1] == 'X'; i++)
+        *--x = chars[r[i] % (sizeof(chars) - 1)];
+}
+
+int capture_materialize(
+    struct capture *cap,
+    struct error_buffer *errbuf) {
+
+    if (cap->keepfd < 0)
+        return 0;
+
+    if (cap->inmemory && capture_spill(cap, &cap->keepfd) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to write out captured output for %s, %s",
+            cap->template, strerror(errno));
+        return -1;
+    }
+
+    char proc[32];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%i", cap->keepfd);
+    const char *suffix = codec_suffix(cap->spec->codec);
+    for (int tries=0; ; tries++) {
+        if (snprintf(cap->buf, PATH_MAX, "%s%s", cap->template, suffix)
+            >= PATH_MAX) {
+            snprintf(errbuf->s, errbuf->n, "template too long, %s",
+                cap->template);
+            return -1;
+        }
+        capture_fill_template(cap->buf, strlen(suffix));
+        if (linkat(AT_FDCWD, proc, AT_FDCWD, cap->buf,
+                AT_SYMLINK_FOLLOW) == 0)
+            break;
+        if (errno != EEXIST || tries >= 100) {
+            snprintf(errbuf->s, errbuf->n, "linkat() failed for %s, %s",
+                cap->buf, strerror(errno));
+            return -1;
+        }
+    }
+    *cap->path = cap->buf;
+    capture_discard(cap);
+    return 0;
+}
+
+void capture_discard(struct capture *cap) {
+    if (cap->keepfd >= 0)
+        close(cap->keepfd);
+    cap->keepfd = -1;
+}
+
+void capture_close(struct capture *cap) {
+    // the codec is already finished if the output has been closed
+    if (cap->spec != NULL && cap->outfd >= 0)
+        codec_free(cap);
+    if (cap->fd >= 0)
+        close(cap->fd);
+    if (cap->childfd >= 0)
+        close(cap->childfd);
+    if (cap->outfd >= 0)
+        close(cap->outfd);
+    cap->fd = cap->childfd = cap->outfd = -1;
+    free(cap->retained);
+    cap->retained = NULL;
+}
@@ -0,0 +1,144 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <zlib.h>
+
+#include "error.h"
+#include "sha256.h"
+#include "store.h"
+
+// Captures a child's output stream through a pipe, which the measuring
+// process pumps into a streaming compressor as data arrives; the
+// uncompressed output never touches the disk.  When capturing into a
+// store, the content is hashed as it streams and the output is named by
+// its hash.
+//
+// Rather than keeping the whole stream in a file, a stream may only be
+// counted, hashed, or have its first or last N bytes retained in memory
+// (to be written out only after the stream finishes).
+//
+// Streams in file mode with neither a codec nor a store aren't captured,
+// the child writes them into a plain file of its own.
+//
+// With memfd set, output files are kept in memory instead, spilling to an
+// unnamed file on disk past memlimit bytes, and are only linked into the
+// filesystem by capture_materialize() for runs that are kept; those that
+// are discarded never touch the filesystem.
+
+#define CAPTURE_MODE_FILE  0
+#define CAPTURE_MODE_COUNT 1
+#define CAPTURE_MODE_HASH  2
+#define CAPTURE_MODE_HEAD  3
+#define CAPTURE_MODE_TAIL  4
+
+#define CAPTURE_CODEC_NONE 0
+#define CAPTURE_CODEC_GZIP 1
+#define CAPTURE_CODEC_ZSTD 2
+
+struct capture_spec {
+    int mode;
+    size_t retain;
+    int codec;
+    int level;
+    const struct store *store;
+    int memfd;
+    size_t memlimit;
+};
+
+#define capture_spec_init() \
+    {CAPTURE_MODE_FILE, 0, CAPTURE_CODEC_NONE, -1, NULL, 0, 0}
+
+// Default memlimit for memfd outputs
+#define CAPTURE_MEMLIMIT (64 << 20)
+
+struct capture {
+    const struct capture_spec *spec;
+    const char *template;
+    int fd;      // read end of the pipe, -1 when not capturing
+    int childfd; // write end of the pipe, for the child
+    int outfd;
+    int keepfd;   // a finished memfd output, until materialized
+    int inmemory; // whether outfd/keepfd is still a memfd
+    size_t outbytes;
+    const char **path;
+    char *buf;   // PATH_MAX bytes for *path
+    long bytes;
+    unsigned char *retained;
+    size_t nretained;
+    z_stream z;
+    void *zstd;
+    struct sha256 hash;
+};
+
+// Parses a codec name, "gzip" or "zstd"
+int capture_codec_parse(
+    const char *name,
+    int *codec,
+    struct error_buffer *errbuf);
+
+// Parses a capture mode, one of "file", "count", "hash", "head:N" or
+// "tail:N"
+int capture_mode_parse(
+    const char *arg,
+    struct capture_spec *spec,
+    struct error_buffer *errbuf);
+
+int capture_active(const struct capture_spec *spec);
+
+void capture_reset(struct capture *cap);
+
+// Creates the pipe and, in file mode, an output file named after template
+// (suffixed by the codec's extension), writing its name into buf (of
+// PATH_MAX bytes) and pointing path at it; when storing, the file is
+// temporary and its name is replaced by the content hash once the stream
+// is finished.  In hash mode path is set to the hash once finished, in
+// count mode it's left NULL.
+int capture_open(
+    struct capture *cap,
+    const struct capture_spec *spec,
+    const char *template,
+    const char **path,
+    char *buf,
+    struct error_buffer *errbuf);
+
+// Must be called in the parent after fork() to close the child's end
+void capture_forked(struct capture *cap);
+
+// Reads what's available from the pipe through the compressor; returns 1
+// if there's more to come, 0 once the stream has been finished, or -1 on
+// error.  Once finished, the pipe should be closed with capture_close().
+int capture_pump(
+    struct capture *cap,
+    struct error_buffer *errbuf);
+
+// Closes the pipe, abandoning any capture still in progress
+void capture_close(struct capture *cap);
+
+// Links a finished memfd output into the filesystem, named after the
+// template, and points path at its name
+int capture_materialize(
+    struct capture *cap,
+    struct error_buffer *errbuf);
+
+// Drops a finished memfd output that wasn't materialized
+void capture_discard(struct capture *cap);
+
+#endif // _CAPTURE_H
@@ -0,0 +1,382 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cgroup.h"
+
+// How long to wait for killed stragglers to leave a leaf
+#define CGROUP_DRAIN_TRIES 1000
+#define CGROUP_DRAIN_NS    1000000
+
+static const char *controllers[] = {"memory", "cpu", "io", "pids"};
+
+static char dirpath[PATH_MAX];
+static char enabled[64];
+static int cgroupfd = -1;
+static unsigned long nleaves = 0;
+
+static ssize_t cgroup_read(
+    const char *name,
+    const char *file,
+    char *buf,
+    size_t size) {
+
+    char path[CGROUP_NAME_MAX + 32];
+    snprintf(path, sizeof(path), "%s/%s", name, file);
+    int fd = openat(cgroupfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t got = read(fd, buf, size - 1);
+    close(fd);
+    if (got < 0)
+        return -1;
+    buf[got] = '\0';
+    return got;
+}
+
+static int cgroup_write(
+    const char *name,
+    const char *file,
+    const char *value) {
+
+    char path[CGROUP_NAME_MAX + 32];
+    snprintf(path, sizeof(path), "%s/%s", name, file);
+    int fd = openat(cgroupfd, path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    size_t len = strlen(value);
+    ssize_t wrote = write(fd, value, len);
+    int err = errno;
+    close(fd);
+    errno = err;
+    return wrote == len ? 0 : -1;
+}
+
+// Finds the cgroup v2 directory that we're running in
+static int cgroup_self(char *buf, size_t size, struct error_buffer *errbuf) {
+    char line[PATH_MAX];
+    char mount[PATH_MAX] = "";
+
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    if (f == NULL) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to open /proc/self/mountinfo, %s", strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        // ... mountpoint ... - fstype source options
+        char *sep = strstr(line, " - ");
+        if (sep == NULL || strncmp(sep + 3, "cgroup2 ", 8) != 0)
+            continue;
+        char *p = line;
+        for (int i=0; i<4 && p != NULL; i++)
+            if ((p = strchr(p, ' ')) != NULL)
+                p++;
+        char *end = p == NULL ? NULL : strchr(p, ' ');
+        if (end != NULL) {
+            *end = '\0';
+            strncpy(mount, p, sizeof(mount) - 1);
+            break;
+        }
+    }
+    fclose(f);
+    if (mount[0] == '\0') {
+        strncpy(errbuf->s, "no cgroup2 filesystem mounted", errbuf->n);
+        return -1;
+    }
+
+    f = fopen("/proc/self/cgroup", "r");
+    if (f == NULL) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to open /proc/self/cgroup, %s", strerror(errno));
+        return -1;
+    }
+    int found = 0;
+    while (fgets(line, sizeof(line), f) != NULL)
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            const char *path = strcmp(line + 3, "/") == 0 ? "" : line + 3;
+            found = snprintf(buf, size, "%s%s", mount, path) < size;
+            break;
+        }
+    fclose(f);
+    if (! found) {
+        strncpy(errbuf->s,
+            "couldn't find our cgroup in /proc/self/cgroup", errbuf->n);
+        return -1;
+    }
+    return 0;
+}
+
+// Moves us into a leaf of our own so that dir has no processes of its own
+static int cgroup_leave(struct error_buffer *errbuf) {
+    char name[CGROUP_NAME_MAX], pid[16];
+    snprintf(name, sizeof(name), "measure-%i", getpid());
+    snprintf(pid, sizeof(pid), "%i", getpid());
+    if ((mkdirat(cgroupfd, name, 0755) < 0 && errno != EEXIST) ||
+        cgroup_write(name, "cgroup.procs", pid) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to move into %s/%s, %s", dirpath, name, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int cgroup_setup(const char *dir, struct error_buffer *errbuf) {
+    if (dir != NULL) {
+        if (realpath(dir, dirpath) == NULL) {
+            snprintf(errbuf->s, errbuf->n,
+                "failed to resolve %s, %s", dir, strerror(errno));
+            return -1;
+        }
+    } else if (cgroup_self(dirpath, sizeof(dirpath), errbuf) < 0) {
+        return -1;
+    }
+
+    cgroupfd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cgroupfd < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to open %s, %s", dirpath, strerror(errno));
+        return -1;
+    }
+
+    char buf[256];
+    if (cgroup_read(".", "cgroup.subtree_control", buf, sizeof(buf)) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "%s isn't a cgroup v2 directory, %s", dirpath, strerror(errno));
+        return -1;
+    }
+
+    // Controllers that aren't available to us are simply left out, their
+    // fields come out as '-'
+    int left = 0;
+    for (int i=0; i<sizeof(controllers) / sizeof(char *); i++) {
+        char value[16];
+        snprintf(value, sizeof(value), "+%s", controllers[i]);
+        if (cgroup_write(".", "cgroup.subtree_control", value) == 0)
+            continue;
+        if (errno == EBUSY && ! left) {
+            // no internal processes, see "no internal process constraint"
+            // in cgroups(7)
+            if (cgroup_leave(errbuf) < 0)
+                return -1;
+            left = 1;
+            i--;
+        }
+    }
+
+    if (cgroup_read(".", "cgroup.subtree_control",
+            enabled, sizeof(enabled)) < 0)
+        enabled[0] = '\0';
+    enabled[strcspn(enabled, "\n")] = '\0';
+
+    return 0;
+}
+
+const char *cgroup_dir(void) {
+    return dirpath;
+}
+
+const char *cgroup_controllers(void) {
+    return enabled;
+}
+
+void cgroup_reset(struct cgroup_run *cg) {
+    cg->name[0]        = '\0';
+    cg->memory_peak    = -1;
+    cg->usage_usec     = -1;
+    cg->user_usec      = -1;
+    cg->system_usec    = -1;
+    cg->nr_throttled   = -1;
+    cg->throttled_usec = -1;
+    cg->io_rbytes      = -1;
+    cg->io_wbytes      = -1;
+    cg->pids_peak      = -1;
+}
+
+int cgroup_enter(
+    struct cgroup_run *cg,
+    pid_t pid,
+    struct error_buffer *errbuf) {
+
+    snprintf(cg->name, sizeof(cg->name),
+        "run-%i-%lu", getpid(), nleaves++);
+    if (mkdirat(cgroupfd, cg->name, 0755) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to create cgroup %s/%s, %s",
+            dirpath, cg->name, strerror(errno));
+        cg->name[0] = '\0';
+        return -1;
+    }
+
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%i", pid);
+    if (cgroup_write(cg->name, "cgroup.procs", buf) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to move %i into cgroup %s/%s, %s",
+            pid, dirpath, cg->name, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int cgroup_pids(const struct cgroup_run *cg, pid_t *pids, int max) {
+    char buf[16384];
+    if (cg->name[0] == '\0' ||
+        cgroup_read(cg->name, "cgroup.procs", buf, sizeof(buf)) <= 0)
+        return 0;
+    int n = 0;
+    for (char *p = buf, *end; n < max; p = end) {
+        long pid = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        pids[n++] = pid;
+    }
+    return n;
+}
+
+static int cgroup_populated(struct cgroup_run *cg) {
+    char buf[256];
+    if (cgroup_read(cg->name, "cgroup.events", buf, sizeof(buf)) < 0)
+        return 0;
+    const char *p = strstr(buf, "populated ");
+    return p != NULL && p[10] == '1';
+}
+
+// Kills anything left behind, e.g. daemonized descendants, and waits for
+// the leaf to empty so that it can be removed
+static int cgroup_drain(struct cgroup_run *cg) {
+    if (! cgroup_populated(cg))
+        return 0;
+
+    if (cgroup_write(cg->name, "cgroup.kill", "1") < 0) {
+        // before Linux 5.14, kill them one by one
+        char buf[4096];
+        if (cgroup_read(cg->name, "cgroup.procs", buf, sizeof(buf)) > 0)
+            for (char *p = strtok(buf, "\n"); p; p = strtok(NULL, "\n"))
+                kill(atoi(p), SIGKILL);
+    }
+
+    struct timespec pause = {0, CGROUP_DRAIN_NS};
+    for (int i=0; i<CGROUP_DRAIN_TRIES; i++) {
+        if (! cgroup_populated(cg))
+            return 0;
+        nanosleep(&pause, NULL);
+    }
+    return -1;
+}
+
+static long cgroup_read_long(struct cgroup_run *cg, const char *file) {
+    char buf[64];
+    if (cgroup_read(cg->name, file, buf, sizeof(buf)) <= 0)
+        return -1;
+    return strtol(buf, NULL, 10);
+}
+
+// Reads "key value" lines from cpu.stat
+static void cgroup_read_cpu(struct cgroup_run *cg) {
+    char buf[1024];
+    if (cgroup_read(cg->name, "cpu.stat", buf, sizeof(buf)) <= 0)
+        return;
+
+    const struct {
+        const char *key;
+        long *val;
+    } keys[] = {
+        {"usage_usec",     &cg->usage_usec},
+        {"user_usec",      &cg->user_usec},
+        {"system_usec",    &cg->system_usec},
+        {"nr_throttled",   &cg->nr_throttled},
+        {"throttled_usec", &cg->throttled_usec}};
+
+    for (char *line = strtok(buf, "\n"); line; line = strtok(NULL, "\n")) {
+        char *val = strchr(line, ' ');
+        if (val == NULL)
+            continue;
+        *(val++) = '\0';
+        for (int i=0; i<sizeof(keys) / sizeof(keys[0]); i++)
+            if (strcmp(line, keys[i].key) == 0)
+                *keys[i].val = strtol(val, NULL, 10);
+    }
+}
+
+// Sums "MAJ:MIN rbytes=N wbytes=N ..." lines from io.stat
+static void cgroup_read_io(struct cgroup_run *cg) {
+    char buf[4096];
+    if (cgroup_read(cg->name, "io.stat", buf, sizeof(buf)) < 0)
+        return;
+
+    cg->io_rbytes = 0;
+    cg->io_wbytes = 0;
+    for (char *p = buf; (p = strchr(p, ' ')) != NULL; ) {
+        p++;
+        if (strncmp(p, "rbytes=", 7) == 0)
+            cg->io_rbytes += strtol(p + 7, NULL, 10);
+        else if (strncmp(p, "wbytes=", 7) == 0)
+            cg->io_wbytes += strtol(p + 7, NULL, 10);
+    }
+}
+
+int cgroup_collect(
+    struct cgroup_run *cg,
+    struct error_buffer *errbuf) {
+
+    if (cg->name[0] == '\0')
+        return 0;
+
+    if (cgroup_drain(cg) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "processes left in cgroup %s/%s wouldn't die",
+            dirpath, cg->name);
+        return -1;
+    }
+
+    cg->memory_peak = cgroup_read_long(cg, "memory.peak");
+    cg->pids_peak   = cgroup_read_long(cg, "pids.peak");
+    cgroup_read_cpu(cg);
+    cgroup_read_io(cg);
+
+    if (unlinkat(cgroupfd, cg->name, AT_REMOVEDIR) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to remove cgroup %s/%s, %s",
+            dirpath, cg->name, strerror(errno));
+        return -1;
+    }
+    cg->name[0] = '\0';
+
+    return 0;
+}
+
+void cgroup_close(struct cgroup_run *cg) {
+    if (cg->name[0] == '\0')
+        return;
+    cgroup_drain(cg);
+    unlinkat(cgroupfd, cg->name, AT_REMOVEDIR);
+    cg->name[0] = '\0';
+}
@@ -0,0 +1,79 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CGROUP_H
+#define _CGROUP_H
+
+#include <sys/types.h>
+
+#include "error.h"
+
+// Per-run accounting with cgroup v2, see cgroups(7).  Each run is moved
+// into a fresh leaf cgroup under a delegated directory while it waits
+// before execv(), so that everything it forks is accounted together;
+// once the child has been reaped, anything left in the leaf is killed,
+// its statistics are read and the leaf is removed.
+
+#define CGROUP_NAME_MAX 48
+
+struct cgroup_run {
+    char name[CGROUP_NAME_MAX]; // of the leaf under the directory, "" if none
+    // all -1 if unavailable, e.g. when the controller isn't enabled
+    long memory_peak;    // bytes, from memory.peak
+    long usage_usec;     // from cpu.stat
+    long user_usec;
+    long system_usec;
+    long nr_throttled;
+    long throttled_usec;
+    long io_rbytes;      // summed over all devices in io.stat
+    long io_wbytes;
+    long pids_peak;      // from pids.peak
+};
+
+// Opens dir, or the cgroup we're running in if dir is NULL, and enables
+// the memory, cpu, io and pids controllers for its children where
+// possible.  If we're running in dir ourselves, we first move into a
+// measure-PID leaf beneath it so that controllers can be enabled.
+int cgroup_setup(const char *dir, struct error_buffer *errbuf);
+
+// The directory given to cgroup_setup()
+const char *cgroup_dir(void);
+
+// The controllers enabled for leaves, as in cgroup.subtree_control
+const char *cgroup_controllers(void);
+
+void cgroup_reset(struct cgroup_run *cg);
+
+// Creates a fresh leaf and moves pid into it
+int cgroup_enter(
+    struct cgroup_run *cg,
+    pid_t pid,
+    struct error_buffer *errbuf);
+
+// Lists the processes in the leaf, returning how many were stored in pids
+int cgroup_pids(const struct cgroup_run *cg, pid_t *pids, int max);
+
+// Kills anything left in the leaf, reads its statistics and removes it
+int cgroup_collect(
+    struct cgroup_run *cg,
+    struct error_buffer *errbuf);
+
+// Kills anything left in the leaf and removes it, without reading it
+void cgroup_close(struct cgroup_run *cg);
+
+#endif // _CGROUP_H
@@ -18,6 +18,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,16 +27,21 @@
 
 #include "childcomm.h"
 #include "child.h"
-
-#define child_die(mess) exit( \
-    child_comm_send_mess(commfd, mess) < 0 \
+#include "sighandler.h"
+
+// NOTE: the child must only ever _exit(), a plain exit() would run the
+// measuring process's atexit(3) cleanup (killing its siblings) in the child.
+// The message goes after whatever is batched, output file paths included,
+// so that the parent can still remove those files.
+#define child_die(mess) _exit( \
+    child_comm_flush_mess(commfd, &batch, mess) < 0 \
     ? CHILD_EXIT_COMMERROR : 1)
 
 struct child_std {
     const char *name;
     int targetfd;
     const char *template;
-    char *path;
+    char path[PATH_MAX];
     int fd;
 };
 
@@ -43,11 +49,12 @@ int child_std_open(
     struct child_std *cs,
     struct error_buffer *errbuf) {
 
-    cs->path = strdup(cs->template);
-    if (cs->path == NULL) {
-        strncpy(errbuf->s, "strdup() failed", errbuf->n);
+    if (strlen(cs->template) >= PATH_MAX) {
+        snprintf(errbuf->s, errbuf->n, "template too long, %s",
+            cs->template);
         return -1;
     }
+    strcpy(cs->path, cs->template);
 
     cs->fd = mkostemp(cs->path, O_WRONLY | O_CLOEXEC);
     if (cs->fd < 0) {
@@ -67,7 +74,7 @@ int child_std_open(
 
 int child_std_setup(
     struct program_result *res,
-    int commfd,
+    struct child_comm_batch *batch,
     struct error_buffer *errbuf) {
 
     if (res->prog->stdinfd > 0)
@@ -77,20 +84,42 @@ int child_std_setup(
             return -1;
         }
 
+    // Re-open stdin so that each run gets its own file offset, rather than
+    // sharing (and racing on) the one inherited from the measuring process.
+    int stdinfd = open("/proc/self/fd/0", O_RDONLY);
+    if (stdinfd >= 0) {
+        if (dup2(stdinfd, STDIN_FILENO) < 0) {
+            snprintf(errbuf->s, errbuf->n,
+                "stdin dup2 failed, %s", strerror(errno));
+            return -1;
+        }
+        close(stdinfd);
+    }
+
     struct child_std cs[] = {
-        {"stdout", STDOUT_FILENO, res->prog->stdout, NULL, -1},
-        {"stderr", STDERR_FILENO, res->prog->stderr, NULL, -1}};
+        {"stdout", STDOUT_FILENO, res->prog->stdout, "", -1},
+        {"stderr", STDERR_FILENO, res->prog->stderr, "", -1}};
 
     for (int i=0; i<sizeof(cs)/sizeof(struct child_std); i++) {
-        if (child_std_open(&cs[i], errbuf) < 0) {
-            if (cs[i].path != NULL) free(cs[i].path);
-            return -1;
+        // captured streams go down the pipe set up by the parent
+        int capfd = res->capture[i].childfd;
+        if (capfd >= 0) {
+            if (dup2(capfd, cs[i].targetfd) < 0) {
+                snprintf(errbuf->s, errbuf->n,
+                    "%s dup2 failed, %s", cs[i].name, strerror(errno));
+                return -1;
+            }
+            continue;
         }
 
-        if (child_comm_send_filepath(commfd, cs[i].name, cs[i].path) < 0)
-            exit(CHILD_EXIT_COMMERROR);
+        if (child_std_open(&cs[i], errbuf) < 0)
+            return -1;
 
-        free(cs[i].path);
+        if (child_comm_add_filepath(batch, cs[i].name, cs[i].path) < 0) {
+            snprintf(errbuf->s, errbuf->n,
+                "%s path too long, %s", cs[i].name, cs[i].path);
+            return -1;
+        }
 
         if (dup2(cs[i].fd, cs[i].targetfd) < 0) {
             snprintf(errbuf->s, errbuf->n,
@@ -102,12 +131,81 @@ int child_std_setup(
     return 0;
 }
 
-void child_run(struct program_result *res, int commfd) {
-    struct error_buffer errbuf;
+// Expands argv's placeholders for this run, see template.h; only ever
+// called in the child, which is about to execv() anyway
+static const char **child_expand_argv(const struct program_result *res) {
+    const struct program *prog = res->prog;
+    struct template_vars vars = {res->run, res->slot, res->tmpdir,
+        res->params};
+
+    int argc = 0;
+    while (prog->argv[argc] != NULL)
+        argc++;
+    const char **argv = calloc(argc + 1, sizeof(char *));
+    if (argv == NULL)
+        return prog->argv;
+
+    for (int i=0; i<argc; i++) {
+        size_t len = template_expand(prog->argv[i], prog->params, &vars,
+            NULL, 0);
+        char *arg = malloc(len + 1);
+        if (arg == NULL)
+            return prog->argv;
+        template_expand(prog->argv[i], prog->params, &vars, arg, len + 1);
+        argv[i] = arg;
+    }
+    return argv;
+}
 
-    if (child_std_setup(res, commfd, &errbuf) < 0)
+void child_run(struct program_result *res, int commfd, int gofd) {
+    char _errbuf[1024];
+    struct error_buffer errbuf = {sizeof(_errbuf)-1, _errbuf};
+
+    // Don't run the measuring process's cleanup if we get killed before
+    // execv()
+    reset_signal_handlers();
+
+    // everything for the parent goes in one write() just before execv()
+    struct child_comm_batch batch;
+    batch.len = 0;
+
+    if (res->prog->phases) {
+        struct timespec t;
+        struct child_comm c = {CHILD_COMM_ID_ENTERTIME, sizeof(t), &t};
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+        child_comm_add(&batch, &c);
+    }
+
+    if (child_std_setup(res, &batch, &errbuf) < 0)
+        child_die(errbuf.s);
+
+    // a pinned slot's cpu narrows any cpu set applied here
+    if (execenv_apply(&res->prog->env, &errbuf) < 0)
         child_die(errbuf.s);
 
+    if (res->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(res->cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &cpus) < 0) {
+            snprintf(errbuf.s, errbuf.n,
+                "sched_setaffinity(%i) failed, %s",
+                res->cpu, strerror(errno));
+            child_die(errbuf.s);
+        }
+    }
+
+    if (gofd >= 0) {
+        char go;
+        ssize_t got;
+        do
+            got = read(gofd, &go, 1);
+        while (got < 0 && errno == EINTR);
+        if (got != 1)
+            child_die("parent gave up before exec");
+        close(gofd);
+    }
+
     struct timespec t;
     struct child_comm c;
     c.id   = CHILD_COMM_ID_STARTTIME;
@@ -120,10 +218,14 @@ void child_run(struct program_result *res, int commfd) {
             strerror(errno));
         child_die(errbuf.s);
     }
-    if (child_comm_write(commfd, &c) < 0)
-        exit(CHILD_EXIT_COMMERROR);
+    if (child_comm_add(&batch, &c) < 0 || child_comm_flush(commfd, &batch) < 0)
+        _exit(CHILD_EXIT_COMMERROR);
+
+    const char **argv = res->prog->argv;
+    if (res->prog->templated)
+        argv = child_expand_argv(res);
 
-    if (execv(res->prog->path, (char * const*) res->prog->argv) < 0) {
+    if (execv(res->prog->path, (char * const*) argv) < 0) {
         snprintf(errbuf.s, errbuf.n,
             "execv() failed, %s", strerror(errno));
         child_die(errbuf.s);
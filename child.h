@@ -21,6 +21,8 @@
 
 #include "program.h"
 
-void child_run(struct program_result *res, int commfd);
+// Runs the child, if gofd isn't -1 the child waits for a byte on it before
+// execv()ing
+void child_run(struct program_result *res, int commfd, int gofd);
 
 #endif // _CHILD_H
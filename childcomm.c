@@ -16,58 +16,117 @@
  * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <stdlib.h>
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "childcomm.h"
 
-#define CHILD_COMM_HDRLEN sizeof(size_t) + 1
-
 int child_comm_send(int fd, const void *buf, size_t len) {
     size_t off = 0;
     while (off < len) {
-        size_t wrote = write(fd, buf + off, len - off);
-        if (wrote < 0) return -1;
+        ssize_t wrote = write(fd, buf + off, len - off);
+        if (wrote < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
         off += wrote;
     }
     return 0;
 }
 
-int child_comm_recv(int fd, void *buf, size_t len) {
+static size_t child_comm_header(
+    unsigned char *buf,
+    const struct child_comm *comm) {
+
+    buf[0] = comm->id;
+    memcpy(buf + 1, &comm->len, sizeof(size_t));
+    return CHILD_COMM_HDRLEN;
+}
+
+int child_comm_write(int fd, const struct child_comm *comm) {
+    unsigned char hdr[CHILD_COMM_HDRLEN];
+    child_comm_header(hdr, comm);
+    if (child_comm_send(fd, hdr, CHILD_COMM_HDRLEN) < 0)
+        return -1;
+    return child_comm_send(fd, comm->data, comm->len);
+}
+
+int child_comm_add(
+    struct child_comm_batch *batch,
+    const struct child_comm *comm) {
+
+    if (CHILD_COMM_BATCH_SIZE - batch->len < CHILD_COMM_HDRLEN + comm->len)
+        return -1;
+    batch->len += child_comm_header(batch->buf + batch->len, comm);
+    memcpy(batch->buf + batch->len, comm->data, comm->len);
+    batch->len += comm->len;
+    return 0;
+}
+
+int child_comm_add_filepath(
+    struct child_comm_batch *batch,
+    const char *name,
+    const char *path) {
+
+    size_t namelen = strlen(name) + 1;
+    size_t pathlen = strlen(path) + 1;
+    struct child_comm c = {CHILD_COMM_ID_FILEPATH, namelen + pathlen, NULL};
+    if (CHILD_COMM_BATCH_SIZE - batch->len < CHILD_COMM_HDRLEN + c.len)
+        return -1;
+
+    // name and path are copied straight into the batch
+    unsigned char *buf = batch->buf + batch->len;
+    buf += child_comm_header(buf, &c);
+    memcpy(buf, name, namelen);
+    memcpy(buf + namelen, path, pathlen);
+    batch->len += CHILD_COMM_HDRLEN + c.len;
+    return 0;
+}
+
+int child_comm_flush(int fd, struct child_comm_batch *batch) {
+    int r = child_comm_send(fd, batch->buf, batch->len);
+    batch->len = 0;
+    return r;
+}
+
+ssize_t child_comm_read_all(int fd, void *buf, size_t size) {
     size_t off = 0;
-    while (off < len) {
-        size_t got = read(fd, buf + off, len - off);
+    for (;;) {
+        if (off == size) {
+            // full, which is only fine if that was everything
+            char c;
+            ssize_t got = read(fd, &c, 1);
+            if (got < 0 && errno == EINTR) continue;
+            return got == 0 ? off : -1;
+        }
+        ssize_t got = read(fd, buf + off, size - off);
         if (got == 0)
-            return -2;
-        if (got < 0)
+            return off;
+        if (got < 0) {
+            if (errno == EINTR) continue;
             return -1;
+        }
         off += got;
     }
-    return 0;
 }
 
-int child_comm_write(int fd, const struct child_comm *comm) {
-    int r = child_comm_send(fd, comm, CHILD_COMM_HDRLEN);
-    if (r < 0) return r;
-    r = child_comm_send(fd, comm->data, comm->len);
-    if (r < 0) return r;
-    return 0;
-}
+ssize_t child_comm_parse(
+    const void *buf,
+    size_t len,
+    struct child_comm *comm) {
 
-int child_comm_read(int fd, struct child_comm *comm) {
-    memset(comm, 0, sizeof(struct child_comm));
-    if (child_comm_recv(fd, comm, CHILD_COMM_HDRLEN) < 0)
-        return COMM_READ_ERR_HEADER;
-    void *buf = malloc(comm->len);
-    if (buf == NULL)
-        return COMM_READ_ERR_MALLOC;
-    if (child_comm_recv(fd, buf, comm->len) < 0) {
-        free(buf);
-        return COMM_READ_ERR_DATA;
-    }
-    comm->data = buf;
-    return 0;
+    if (len == 0)
+        return 0;
+    if (len < CHILD_COMM_HDRLEN)
+        return -1;
+    const unsigned char *p = buf;
+    comm->id = p[0];
+    memcpy(&comm->len, p + 1, sizeof(size_t));
+    if (len - CHILD_COMM_HDRLEN < comm->len)
+        return -1;
+    comm->data = p + CHILD_COMM_HDRLEN;
+    return CHILD_COMM_HDRLEN + comm->len;
 }
 
 int child_comm_send_mess(int fd, const char *mess) {
@@ -78,28 +137,16 @@ int child_comm_send_mess(int fd, const char *mess) {
     return child_comm_write(fd, &c);
 }
 
-int child_comm_send_filepath(int fd, const char *name, const char *path) {
-    size_t namelen = strlen(name);
-    size_t pathlen = strlen(path);
-    void *buf;
-    struct child_comm c;
-    c.id   = CHILD_COMM_ID_FILEPATH;
-    c.len  = namelen + 1 + pathlen + 1;
-    c.data = buf = malloc(c.len);
-    if (buf == NULL)
-        return -1;
-
-    memcpy(buf, name, namelen);
-    buf += namelen;
-    *((char *) buf++) = '\0';
-
-    memcpy(buf, path, pathlen);
-    buf += pathlen;
-    *((char *) buf++) = '\0';
+int child_comm_flush_mess(
+    int fd,
+    struct child_comm_batch *batch,
+    const char *mess) {
 
-    int r = 0;
-    if (child_comm_write(fd, &c) < 0)
-        r = -1;
-    free((void *) c.data);
-    return r;
+    struct child_comm c;
+    c.id   = CHILD_COMM_ID_MESS;
+    c.len  = strlen(mess)+1;
+    c.data = mess;
+    if (child_comm_add(batch, &c) == 0 && child_comm_flush(fd, batch) == 0)
+        return 0;
+    return child_comm_write(fd, &c);
 }
@@ -16,30 +16,73 @@
  * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
+#include <stddef.h>
+#include <sys/types.h>
+
 struct child_comm {
     unsigned char id;
     size_t len;
     const void *data;
 };
 
-int child_comm_send(int fd, const void *buf, size_t len);
+// Each message is its id byte and length followed by its data
+#define CHILD_COMM_HDRLEN (1 + sizeof(size_t))
+
+// The child batches its messages up to send them with a single write()
+// just before its execv(), room enough for both output paths, a couple of
+// times and an error message
+#define CHILD_COMM_MESS_MAX 1024
+#define CHILD_COMM_BATCH_SIZE \
+    (2 * (CHILD_COMM_HDRLEN + 8 + PATH_MAX) + CHILD_COMM_MESS_MAX)
+
+struct child_comm_batch {
+    size_t len;
+    unsigned char buf[CHILD_COMM_BATCH_SIZE];
+};
 
-int child_comm_recv(int fd, void *buf, size_t len);
+int child_comm_send(int fd, const void *buf, size_t len);
 
 int child_comm_write(int fd, const struct child_comm *comm);
 
-#define COMM_READ_ERR_HEADER -1
-#define COMM_READ_ERR_MALLOC -2
-#define COMM_READ_ERR_DATA   -3
+// Adds a message to the batch, -1 if there isn't room for it
+int child_comm_add(
+    struct child_comm_batch *batch,
+    const struct child_comm *comm);
+
+int child_comm_add_filepath(
+    struct child_comm_batch *batch,
+    const char *name,
+    const char *path);
+
+// Sends everything in the batch, emptying it
+int child_comm_flush(int fd, struct child_comm_batch *batch);
+
+// Reads everything the child sends, until end of file, into buf; returns
+// the length read, -1 on a read error or if it doesn't fit
+ssize_t child_comm_read_all(int fd, void *buf, size_t size);
 
-int child_comm_read(int fd, struct child_comm *comm);
+// Parses the message at the start of buf into comm, its data pointing into
+// buf; returns the message's whole length, 0 when buf is empty, or -1 if
+// the message is cut short
+ssize_t child_comm_parse(
+    const void *buf,
+    size_t len,
+    struct child_comm *comm);
 
 #define CHILD_COMM_ID_MESS 0x01
 #define CHILD_COMM_ID_STARTTIME 0x02
 #define CHILD_COMM_ID_FILEPATH 0x03
+#define CHILD_COMM_ID_ENTERTIME 0x04
 
 int child_comm_send_mess(int fd, const char *mess);
 
-int child_comm_send_filepath(int fd, const char *name, const char *path);
+// Sends mess after anything still in the batch, so that the parent hears
+// of the files made so far before the failure; sends mess alone if the
+// batch can't be sent
+int child_comm_flush_mess(
+    int fd,
+    struct child_comm_batch *batch,
+    const char *mess);
 
 #define CHILD_EXIT_COMMERROR 0xff
@@ -0,0 +1,187 @@
+#!/usr/bin/python
+# Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+#
+# This file is part of measure, a program to measure programs.
+#
+# Measure is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Measure is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+
+
+import sys
+from math import erfc, exp, lgamma, log, sqrt
+from statistics import NormalDist, mean, variance
+from measure import *
+
+# compares the two variants of a sample --compare run, field by field:
+# - the difference of means (second less first) with a Welch t confidence
+#   interval
+# - the Hodges-Lehmann estimate of the shift, the median of all pairwise
+#   differences, which unlike the mean isn't dragged around by outliers
+# - a two-sided Mann-Whitney U test p-value, by normal approximation with
+#   a tie correction, so as not to assume the values are normal
+# with --param, each combination of parameter values is compared on its own
+
+def incomplete_beta(x, a, b):
+    # regularized I_x(a, b), by Lentz's continued fraction
+    if x <= 0 or x >= 1:
+        return 0.0 if x <= 0 else 1.0
+    if x > (a + 1) / (a + b + 2):
+        return 1 - incomplete_beta(1 - x, b, a)
+    front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+                a * log(x) + b * log(1 - x)) / a
+    tiny = 1e-300
+    c, d = 1.0, 1 - (a + b) * x / (a + 1)
+    d = 1 / (d if abs(d) > tiny else tiny)
+    f = d
+    for m in range(1, 300):
+        for num in (m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m)),
+                    -(a + m) * (a + b + m) * x /
+                        ((a + 2 * m) * (a + 2 * m + 1))):
+            d = 1 + num * d
+            d = 1 / (d if abs(d) > tiny else tiny)
+            c = 1 + num / c
+            c = c if abs(c) > tiny else tiny
+            f *= c * d
+        if abs(c * d - 1) < 1e-15:
+            break
+    return front * f
+
+def t_quantile(p, df):
+    # Student's t, for fractional degrees of freedom too as Welch's are,
+    # by bisecting its cdf; stats.c's expansion is only good from 3 up
+    def cdf(t):
+        return 1 - incomplete_beta(df / (df + t * t), df / 2, 0.5) / 2
+    lo, hi = 0.0, max(1.0, NormalDist().inv_cdf(p))
+    while cdf(hi) < p:
+        lo, hi = hi, hi * 2
+    for _ in range(100):
+        mid = (lo + hi) / 2
+        if cdf(mid) < p:
+            lo = mid
+        else:
+            hi = mid
+    return (lo + hi) / 2
+
+def welch(a, b, confidence):
+    va, vb = variance(a) / len(a), variance(b) / len(b)
+    diff = mean(b) - mean(a)
+    if va + vb == 0:
+        return diff, 0.0
+    df = (va + vb) ** 2 / (va ** 2 / (len(a) - 1) + vb ** 2 / (len(b) - 1))
+    return diff, t_quantile((1 + confidence) / 2, df) * sqrt(va + vb)
+
+def hodges_lehmann(a, b):
+    diffs = sorted(y - x for x in a for y in b)
+    n = len(diffs)
+    return (diffs[(n - 1) // 2] + diffs[n // 2]) / 2
+
+def mann_whitney(a, b):
+    values = sorted([(x, 0) for x in a] + [(y, 1) for y in b])
+    n = len(values)
+    ranksum, ties = 0.0, 0
+    i = 0
+    while i < n:
+        j = i
+        while j < n and values[j][0] == values[i][0]:
+            j += 1
+        rank = (i + j + 1) / 2
+        ranksum += rank * sum(1 for _, v in values[i:j] if v == 0)
+        ties += (j - i) ** 3 - (j - i)
+        i = j
+    na, nb = len(a), len(b)
+    u = ranksum - na * (na + 1) / 2
+    sigma2 = na * nb / 12 * ((n + 1) - ties / (n * (n - 1)))
+    if sigma2 <= 0:
+        return u, 1.0
+    z = (abs(u - na * nb / 2) - 0.5) / sqrt(sigma2)
+    return u, min(1.0, erfc(max(z, 0) / sqrt(2)))
+
+def number(x):
+    # times compare in seconds
+    return x.asfloat() if hasattr(x, 'asfloat') else x
+
+def compare(run, confidence):
+    collection = run.results()
+    fields = list(collection.fields)
+    if 'variant' not in fields:
+        raise ValueError('%s has no variant field, not a --compare run' % (
+            run.samplename,))
+    variants = collection[fields.index('variant')]
+    params = [(field[6:], sample) for field, sample in zip(fields, collection)
+              if field.startswith('param_')]
+    combos = [','.join('%s=%s' % (name, sample[i]) for name, sample in params)
+              for i in range(len(variants))]
+    for combo in sorted(set(combos), key=combos.index):
+        for field, sample in zip(fields, collection):
+            if field == 'variant' or field.startswith('param_'):
+                continue
+            sample = [None if x is None else number(x) for x in sample]
+            a, b = [], []
+            for v, c, x in zip(variants, combos, sample):
+                if c == combo and x is not None:
+                    (b if v else a).append(x)
+            if len(a) < 2 or len(b) < 2:
+                continue
+            diff, halfwidth = welch(a, b, confidence)
+            _, p = mann_whitney(a, b)
+            ma = mean(a)
+            yield (combo or '-', field, len(a), len(b), ma, mean(b), diff,
+                   diff / ma * 100 if ma else None, halfwidth,
+                   hodges_lehmann(a, b), p)
+
+columns = ('params', 'field', 'n_a', 'n_b', 'mean_a', 'mean_b', 'diff', 'diff_pct',
+           'ci_halfwidth', 'hl_shift', 'mw_p')
+
+def fmt(x):
+    if x is None:
+        return '-'
+    if isinstance(x, float):
+        return '%.6g' % (x,)
+    return str(x)
+
+import argparse
+parser = argparse.ArgumentParser()
+parser.add_argument('--table', '-t', action='store_true',
+    help='Output in space-delimited table format')
+parser.add_argument('--confidence', '-c', type=float, default=0.95,
+    help='Confidence of the difference intervals (default 0.95)')
+parser.add_argument('files', metavar='FILE', nargs='*',
+    help='Sample files to read, use STDIN if none given')
+args = parser.parse_args()
+
+runs = map(load_run, args.files or [sys.stdin])
+
+if args.table:
+    print('samplename', *columns)
+    for run in runs:
+        for row in compare(run, args.confidence):
+            print(run.samplename, *map(fmt, row))
+
+else:
+    for i, run in enumerate(runs):
+        if i > 0:
+            print()
+        print('== Comparison of %s' % (run.samplename,))
+        rows = list(compare(run, args.confidence))
+        if not rows:
+            continue
+        maxlen = max(len(row[1]) for row in rows) + 2
+        last = None
+        for (combo, field, na, nb, ma, mb, diff, pct, halfwidth, hl,
+             p) in rows:
+            if combo != last and combo != '-':
+                print('-- %s' % (combo,))
+            last = combo
+            print('%s%s -> %s  diff %s +- %s (%s%%)  shift %s  p=%s' % (
+                (field + ':').ljust(maxlen), fmt(ma), fmt(mb), fmt(diff),
+                fmt(halfwidth), fmt(pct), fmt(hl), fmt(p)))
@@ -0,0 +1,54 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "duration.h"
+
+static const struct {
+    const char *suffix;
+    long ns;
+} duration_units[] = {
+    {"",   1000000},
+    {"ns", 1},
+    {"us", 1000},
+    {"ms", 1000000},
+    {"s",  1000000000},
+    {"m",  60000000000}};
+
+int duration_parse(
+    const char *arg,
+    long *ns,
+    struct error_buffer *errbuf) {
+
+    char *end;
+    double val = strtod(arg, &end);
+    if (end != arg && val > 0)
+        for (int i=0; i<sizeof(duration_units) / sizeof(duration_units[0]); i++)
+            if (strcmp(end, duration_units[i].suffix) == 0 &&
+                val * duration_units[i].ns >= 1) {
+                *ns = val * duration_units[i].ns;
+                return 0;
+            }
+
+    snprintf(errbuf->s, errbuf->n,
+        "invalid duration \"%s\", expected e.g. 10ms", arg);
+    return -1;
+}
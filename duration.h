@@ -0,0 +1,31 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DURATION_H
+#define _DURATION_H
+
+#include "error.h"
+
+// Parses a duration such as "10ms" into nanoseconds; units are ns, us, ms,
+// s and m, with bare numbers taken as milliseconds.
+int duration_parse(
+    const char *arg,
+    long *ns,
+    struct error_buffer *errbuf);
+
+#endif // _DURATION_H
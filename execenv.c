@@ -0,0 +1,247 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/personality.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "execenv.h"
+#include "record.h"
+#include "topology.h"
+
+static const struct {
+    const char *name;
+    int policy;
+    int prioritized;
+} execenv_policies[] = {
+    {"other", SCHED_OTHER, 0},
+    {"batch", SCHED_BATCH, 0},
+    {"idle",  SCHED_IDLE,  0},
+    {"fifo",  SCHED_FIFO,  1},
+    {"rr",    SCHED_RR,    1}};
+
+#define execenv_npolicies \
+    (sizeof(execenv_policies) / sizeof(execenv_policies[0]))
+
+static const struct {
+    const char *name;
+    int mode;
+} execenv_numamodes[] = {
+    {"local",      MPOL_LOCAL},
+    {"bind",       MPOL_BIND},
+    {"interleave", MPOL_INTERLEAVE},
+    {"preferred",  MPOL_PREFERRED}};
+
+#define execenv_nnumamodes \
+    (sizeof(execenv_numamodes) / sizeof(execenv_numamodes[0]))
+
+int execenv_parse_cpus(
+    struct exec_env *env,
+    const char *list,
+    struct error_buffer *errbuf) {
+
+    if (cpu_list_parse(list, &env->cpus, errbuf) < 0)
+        return -1;
+    if (CPU_COUNT(&env->cpus) == 0) {
+        snprintf(errbuf->s, errbuf->n, "empty cpu list \"%s\"", list);
+        return -1;
+    }
+    env->cpulist = list;
+    return 0;
+}
+
+int execenv_parse_sched(
+    struct exec_env *env,
+    const char *arg,
+    struct error_buffer *errbuf) {
+
+    size_t len = strcspn(arg, ":");
+    for (int i=0; i<execenv_npolicies; i++) {
+        if (strlen(execenv_policies[i].name) != len ||
+            strncmp(arg, execenv_policies[i].name, len) != 0)
+            continue;
+
+        env->policy = execenv_policies[i].policy;
+        env->priority = 0;
+        if (! execenv_policies[i].prioritized) {
+            if (arg[len] == '\0')
+                return 0;
+            break;
+        }
+
+        int min = sched_get_priority_min(env->policy);
+        int max = sched_get_priority_max(env->policy);
+        env->priority = min;
+        if (arg[len] == '\0')
+            return 0;
+        char *end;
+        env->priority = strtol(arg + len + 1, &end, 10);
+        if (*end != '\0' || end == arg + len + 1 ||
+            env->priority < min || env->priority > max) {
+            snprintf(errbuf->s, errbuf->n,
+                "invalid priority in \"%s\", expected %i-%i", arg, min, max);
+            return -1;
+        }
+        return 0;
+    }
+
+    snprintf(errbuf->s, errbuf->n, "invalid scheduling policy \"%s\", "
+        "expected other, batch, idle, fifo[:PRIO] or rr[:PRIO]", arg);
+    return -1;
+}
+
+int execenv_parse_numa(
+    struct exec_env *env,
+    const char *arg,
+    struct error_buffer *errbuf) {
+
+    size_t len = strcspn(arg, ":");
+    for (int i=0; i<execenv_nnumamodes; i++) {
+        if (strlen(execenv_numamodes[i].name) != len ||
+            strncmp(arg, execenv_numamodes[i].name, len) != 0)
+            continue;
+
+        env->numamode = execenv_numamodes[i].mode;
+        CPU_ZERO(&env->nodes);
+        if (env->numamode == MPOL_LOCAL) {
+            if (arg[len] == '\0')
+                return 0;
+            break;
+        }
+        if (arg[len] != ':' ||
+            cpu_list_parse(arg + len + 1, &env->nodes, errbuf) < 0 ||
+            CPU_COUNT(&env->nodes) == 0)
+            break;
+        if (env->numamode == MPOL_PREFERRED && CPU_COUNT(&env->nodes) != 1) {
+            snprintf(errbuf->s, errbuf->n,
+                "preferred takes a single node, got \"%s\"", arg);
+            return -1;
+        }
+        return 0;
+    }
+
+    snprintf(errbuf->s, errbuf->n, "invalid NUMA policy \"%s\", expected "
+        "local, bind:NODES, interleave:NODES or preferred:NODE", arg);
+    return -1;
+}
+
+int execenv_apply(
+    const struct exec_env *env,
+    struct error_buffer *errbuf) {
+
+    if (env->norandomize &&
+        personality(personality(0xffffffff) | ADDR_NO_RANDOMIZE) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "personality(ADDR_NO_RANDOMIZE) failed, %s", strerror(errno));
+        return -1;
+    }
+
+    if (env->hasnice && setpriority(PRIO_PROCESS, 0, env->nice) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "setpriority(%i) failed, %s", env->nice, strerror(errno));
+        return -1;
+    }
+
+    if (env->policy >= 0) {
+        struct sched_param param = {.sched_priority = env->priority};
+        if (sched_setscheduler(0, env->policy, &param) < 0) {
+            snprintf(errbuf->s, errbuf->n,
+                "sched_setscheduler() failed, %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    if (env->cpulist != NULL &&
+        sched_setaffinity(0, sizeof(cpu_set_t), &env->cpus) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "sched_setaffinity(%s) failed, %s", env->cpulist, strerror(errno));
+        return -1;
+    }
+
+    if (env->numamode >= 0 &&
+        syscall(SYS_set_mempolicy, env->numamode,
+            env->numamode == MPOL_LOCAL ? NULL : (unsigned long *) &env->nodes,
+            env->numamode == MPOL_LOCAL ? 0 : CPU_SETSIZE) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "set_mempolicy() failed, %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// Formats set as a kernel style list
+static void execenv_list(const cpu_set_t *set, char *buf, size_t n) {
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int i=0; i<CPU_SETSIZE && len < n; i++) {
+        if (! CPU_ISSET(i, set))
+            continue;
+        int j = i;
+        while (j + 1 < CPU_SETSIZE && CPU_ISSET(j + 1, set))
+            j++;
+        if (j > i)
+            len += snprintf(buf + len, n - len, "%s%i-%i",
+                len > 0 ? "," : "", i, j);
+        else
+            len += snprintf(buf + len, n - len, "%s%i", len > 0 ? "," : "", i);
+        i = j;
+    }
+}
+
+void execenv_info(
+    const struct exec_env *env,
+    struct record_schema *schema) {
+
+    char buf[1024];
+    if (env->cpulist != NULL) {
+        execenv_list(&env->cpus, buf, sizeof(buf));
+        record_info(schema, "cpus=%s", buf);
+    }
+
+    if (env->hasnice)
+        record_info(schema, "nice=%i", env->nice);
+
+    for (int i=0; i<execenv_npolicies; i++)
+        if (env->policy == execenv_policies[i].policy) {
+            if (execenv_policies[i].prioritized)
+                record_info(schema, "sched=%s:%i",
+                    execenv_policies[i].name, env->priority);
+            else
+                record_info(schema, "sched=%s", execenv_policies[i].name);
+        }
+
+    if (env->norandomize)
+        record_info(schema, "aslr=off");
+
+    for (int i=0; i<execenv_nnumamodes; i++)
+        if (env->numamode == execenv_numamodes[i].mode) {
+            execenv_list(&env->nodes, buf, sizeof(buf));
+            if (env->numamode == MPOL_LOCAL)
+                record_info(schema, "numa=%s", execenv_numamodes[i].name);
+            else
+                record_info(schema, "numa=%s:%s",
+                    execenv_numamodes[i].name, buf);
+        }
+}
@@ -0,0 +1,77 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _EXECENV_H
+#define _EXECENV_H
+
+#include <sched.h>
+
+#include "error.h"
+
+// The execution environment that the child sets up for itself between
+// fork() and execv(), to cut down run-to-run noise: the cpus it may run
+// on, its nice value and scheduling policy, address space randomization
+// and its NUMA memory policy.
+
+struct record_schema;
+
+struct exec_env {
+    const char *cpulist;  // NULL if any cpu will do
+    cpu_set_t cpus;
+    int hasnice;
+    int nice;
+    int policy;           // SCHED_*, -1 to leave as is
+    int priority;         // for SCHED_FIFO and SCHED_RR
+    int norandomize;      // personality(ADDR_NO_RANDOMIZE)
+    int numamode;         // MPOL_*, -1 to leave as is
+    cpu_set_t nodes;      // NUMA nodes, as a bitmask like cpus
+};
+
+#define execenv_init() {NULL, {{0}}, 0, 0, -1, 0, 0, -1, {{0}}}
+
+// Parses a kernel style cpu list for the child to run on
+int execenv_parse_cpus(
+    struct exec_env *env,
+    const char *list,
+    struct error_buffer *errbuf);
+
+// Parses a scheduling policy, one of "other", "batch", "idle", "fifo:PRIO"
+// or "rr:PRIO"
+int execenv_parse_sched(
+    struct exec_env *env,
+    const char *arg,
+    struct error_buffer *errbuf);
+
+// Parses a NUMA memory policy, one of "local", "bind:NODES",
+// "interleave:NODES" or "preferred:NODE", NODES being a list like cpus
+int execenv_parse_numa(
+    struct exec_env *env,
+    const char *arg,
+    struct error_buffer *errbuf);
+
+// Applies env to the calling process, to be called in the child
+int execenv_apply(
+    const struct exec_env *env,
+    struct error_buffer *errbuf);
+
+// Describes env with an info line for each setting
+void execenv_info(
+    const struct exec_env *env,
+    struct record_schema *schema);
+
+#endif // _EXECENV_H
@@ -16,6 +16,7 @@
 # You should have received a copy of the GNU General Public License
 # along with Measure.  If not, see <http://www.gnu.org/licenses/>.
 
+import sys
 from math import modf
 from measure import *
 
@@ -25,6 +26,9 @@ def run_stats(run):
     collection = run.results()
     yield 'samples', len(collection[0])
     for field, sample in zip(collection.fields, collection):
+        if field.startswith('param_'):
+            # parameter values aren't averaged
+            continue
         sample = [x for x in sample if x is not None]
         if sample:
             mean = round(sum(sample) / len(sample), 2)
@@ -40,12 +44,11 @@ import argparse
 parser = argparse.ArgumentParser()
 parser.add_argument('--table', '-t', action='store_true',
     help='Output in space-delimited table format')
-parser.add_argument('files', metavar='FILE',
-    type=argparse.FileType('r'), nargs='*',
+parser.add_argument('files', metavar='FILE', nargs='*',
     help='Sample files to read, use STDIN if none given')
 args = parser.parse_args()
 
-runs = map(Run, args.files)
+runs = map(load_run, args.files or [sys.stdin])
 
 if args.table:
     fields = None
@@ -18,74 +18,205 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "attach.h"
+#include "cache.h"
+#include "cgroup.h"
+#include "duration.h"
 #include "error.h"
+#include "perf.h"
+#include "pipeline.h"
+#include "pool.h"
 #include "program.h"
+#include "rate.h"
+#include "record.h"
 #include "sighandler.h"
-
-// TODO:
-// * variable arguments per execution for, e.g., output filenames as arguments
-
-void print_result(struct program_result *res) {
-    printf("%us,%uns", res->start.tv_sec, res->start.tv_nsec);
-    putchar(' ');
-
-    printf("%us,%uns", res->end.tv_sec, res->end.tv_nsec);
-    putchar(' ');
-
-    struct rusage *r = &res->rusage;
-
-    printf("%us,%uus", r->ru_utime.tv_sec, r->ru_utime.tv_usec);
-    putchar(' ');
-
-    printf("%us,%uus", r->ru_stime.tv_sec, r->ru_stime.tv_usec);
-    putchar(' ');
-
-    printf("%u %u %u %u %u %u %u %u %u %u %u %u %u %u",
-        r->ru_maxrss, r->ru_ixrss,
-        r->ru_idrss, r->ru_isrss,
-        r->ru_minflt, r->ru_majflt, r->ru_nswap,
-        r->ru_inblock, r->ru_oublock,
-        r->ru_msgsnd, r->ru_msgrcv, r->ru_nsignals,
-        r->ru_nvcsw, r->ru_nivcsw);
-
-    printf(" %d %s %s", res->status, res->stdout, res->stderr);
-}
+#include "stats.h"
+#include "store.h"
+#include "template.h"
+#include "topology.h"
+#include "warmup.h"
 
 // for placing error messages in
 #define ERRBUF_SIZE 4096
 
 // for reading stdin
-#define BUFFER_SIZE 4096
+#define BUFFER_SIZE 65536
+#define STDIN_CHUNK_SIZE (1 << 30)
+
+// Fewest runs before --until-ci will consider stopping
+#define UNTIL_CI_MIN_RUNS 5
 
 static const char *calledname = NULL;
 
 void usage(unsigned int longhelp) {
     fprintf(stderr,
-        "Usage: %s [options] [--] command [command arguments]\n"
+        "Usage: %s [options] [--] command [command arguments]\n",
+        calledname);
+    if (strcmp(calledname, "sample") == 0)
+        fprintf(stderr,
+            "       %s --compare [options] [--] command [command arguments]"
+            " --- command [command arguments]\n",
+            calledname);
+    fprintf(stderr,
+        "       %s -p PID [--interval=<DURATION>] [--perf] [--format=...]\n",
+        calledname);
+    fprintf(stderr,
         "Run a command %s and collect various measurements.\n"
         "\n",
-        calledname,
         strcmp(calledname, "sample") == 0 ? "repeatedly" : "once");
     fprintf(stderr,
         "  -h          Show short usage screen.\n"
         "  --help      Show usage with explanatory epilog.\n"
         "  --usage     Print resource usage of the measuring process before\n"
         "              each command run.\n"
-        "  --compress-stdout\n"
-        "              Compress stdout files with gzip\n"
-        "  --compress-stderr\n"
-        "              Compress stderr files with gzip\n");
+        "  --capture-stdout=<MODE>\n"
+        "  --capture-stderr=<MODE>\n"
+        "              How to capture the stream, MODE is one of:\n"
+        "                file    keep it all in a file (the default)\n"
+        "                count   discard it, only counting bytes\n"
+        "                hash    discard it, only keeping its SHA-256\n"
+        "                head:N  keep only the first N bytes\n"
+        "                tail:N  keep only the last N bytes\n"
+        "              Other than file, streams are piped through the\n"
+        "              measuring process rather than written to disk; kept\n"
+        "              bytes are only written out once the run finishes.\n"
+        "  --compress-stdout[=gzip|zstd]\n"
+        "              Compress stdout as it's written, with gzip by default\n"
+        "  --compress-stderr[=gzip|zstd]\n"
+        "              Compress stderr as it's written, with gzip by default\n"
+        "  --compress-level=<N>\n"
+        "              Compression level to use, defaults to the codec's own\n"
+        "  --memfd[=<LIMIT>]\n"
+        "              Keep file outputs in memory, spilling to an unnamed\n"
+        "              file past LIMIT bytes (default 64M, k, M and G\n"
+        "              suffixes), only naming them on disk for recorded runs.\n"
+        "  --preload-stdin\n"
+        "              Copy stdin into memory even when it's a regular file,\n"
+        "              and lock it there, so that reading it costs the same\n"
+        "              in every run (piped stdin is always kept in memory).\n"
+        "  --store=<DIR>\n"
+        "              Keep outputs in a content-addressed store under DIR,\n"
+        "              named by the SHA-256 of their content, so that identical\n"
+        "              outputs are only stored once; a copy of the sample data\n"
+        "              is kept under DIR/runs.\n"
+        "  --perf      Count cycles, instructions, cache and branch misses and\n"
+        "              stalled cycles of each run with hardware performance\n"
+        "              counters.\n"
+        "  --cgroup[=<DIR>]\n"
+        "              Run each command in a fresh cgroup v2 leaf under DIR (by\n"
+        "              default the cgroup we're running in), accounting memory,\n"
+        "              cpu, io and pids of all of its processes together.\n"
+        "  --timeline=<INTERVAL>\n"
+        "              Sample the memory and cpu usage of each run and its\n"
+        "              descendants every INTERVAL (e.g. 10ms, 1s) into a\n"
+        "              timeline_XXXXXX side file.\n"
+        "  --stats[=<FILE>]\n"
+        "              Keep running statistics of every field, writing a\n"
+        "              summary to FILE (or stderr) on exit.\n"
+        "  --stats-every=<K>\n"
+        "              Also write the summary every K runs.\n"
+        "  --cpus=<LIST>\n"
+        "              Run the command only on the listed cpus, e.g. 2-3,6.\n"
+        "  --nice=<N>  Run the command at nice value N.\n"
+        "  --sched=other|batch|idle|fifo[:PRIO]|rr[:PRIO]\n"
+        "              Run the command under the given scheduling policy;\n"
+        "              beware that a realtime policy may starve everything\n"
+        "              else on its cpus, including the measuring process.\n"
+        "  --no-aslr   Disable address space randomization for the command.\n"
+        "  --numa=local|bind:<NODES>|interleave:<NODES>|preferred:<NODE>\n"
+        "              Set the command's NUMA memory policy.\n"
+        "  --cache=cold|cold:drop|warm\n"
+        "              Before each run evict the command, its stdin file\n"
+        "              and any --cache-file from the page cache (and with\n"
+        "              drop, the whole page cache if allowed), or read them\n"
+        "              in.\n"
+        "  --cache-file=<FILE>\n"
+        "              Also evict or read in FILE, may be given many times.\n"
+        "  --exec-time Time each run from when its execv() succeeded, as\n"
+        "              noticed by the end of a close-on-exec pipe, and from\n"
+        "              just before its fork().\n"
+        "  --phases    Time measure's own phases around each run.\n"
+        "  --noise     Record what the machine was doing during each run:\n"
+        "              other tasks' cpu time, pressure stalls, runnable\n"
+        "              tasks and memory reclaim.\n"
+        "  --noise-reject=<FIELD>:<MAX>\n"
+        "              With --noise, run again in place of any run with more\n"
+        "              than MAX of the noise FIELD, e.g. psi_cpu_usec:1000;\n"
+        "              may be given many times.  Only noise_cpu leaves out\n"
+        "              the run itself: the psi_* and vm_* fields count its\n"
+        "              own stalls and reclaim too.\n"
+        "  --procstat  Read each run's /proc schedstat, io and status while\n"
+        "              it's a zombie, before reaping it.\n"
+        "  -p <PID>    Attach to the already running process PID instead of\n"
+        "              running a command, and record it every interval until\n"
+        "              it exits.\n"
+        "  --interval=<DURATION>\n"
+        "              With -p, how often to record (default 1s).\n"
+        "  --calibrate[=<N>]\n"
+        "              First run an empty command N times (default 30) to\n"
+        "              estimate measure's overhead on wallclock.\n"
+        "  --format=text|binary\n"
+        "              Output records as text (the default) or binary.\n");
     if (strcmp(calledname, "sample") == 0)
         fprintf(stderr,
-            "  -n <N>      Only sample N times rather than indefinately.\n");
+            "  -n <N>      Only sample N times rather than indefinately.\n"
+            "  -j <N>      Keep N command runs in flight at once.\n"
+            "  --pin       Pin each of the -j slots to a distinct physical\n"
+            "              core (SMT siblings are skipped), within --cpus.\n"
+            "  --pipeline  Finish off each recorded run (linking in-memory\n"
+            "              outputs, writing its record, removing its files)\n"
+            "              on a worker thread while the next run is already\n"
+            "              going; the worker keeps off the cores of --pin and\n"
+            "              --cpus.\n"
+            "  --until-ci=<W>[%%][@<C>]\n"
+            "              Stop once the C%% (default 95%%) confidence interval\n"
+            "              of the mean is within +/- W (e.g. 1%%) of it, after at\n"
+            "              least %i runs; -n and --max-time still bound the runs.\n"
+            "  --ci-metric=<FIELD>\n"
+            "              The field whose mean --until-ci watches, and that\n"
+            "              warm-up is detected on, by default wallclock.\n"
+            "  --warmup=auto|detect|<N>\n"
+            "              Detect when warm-up (e.g. of caches) ends by MSER-5;\n"
+            "              with auto, runs aren't recorded until a steady state\n"
+            "              is reached, with detect all runs are recorded and the\n"
+            "              trailer says how many of them were warm-up.  Or just\n"
+            "              don't record the first N runs.\n"
+            "  --max-time=<DURATION>\n"
+            "              Stop starting runs after DURATION (e.g. 10s, 5m).\n"
+            "  --param <NAME>=<V1>,<V2>,...\n"
+            "              Run with each value of NAME in turn, cycling through\n"
+            "              every combination of all the --params; -n then counts\n"
+            "              runs of each.  Arguments may use {param:NAME}, and\n"
+            "              {run}, {slot} and {tmpdir} (a fresh directory for each\n"
+            "              run) whether or not there are params.\n"
+            "  --compare   Interleave runs of two commands, separated by ---,\n"
+            "              in a random order within each pair of runs; -n then\n"
+            "              counts runs of each.  See compare.py.\n"
+            "  --rate=<R>[/s|/ms|/m]\n"
+            "              Start runs at R a second (or as given) on a schedule\n"
+            "              of their own rather than each as the last one exits,\n"
+            "              keeping up to -j (default %i) in flight; each record\n"
+            "              then has the run's intended start and its start_lag\n"
+            "              and latency from then.\n"
+            "  --poisson   Make --rate a Poisson process, with exponentially\n"
+            "              distributed gaps between starts.\n"
+            "  --seed=<N>  Seed the --compare order and --poisson gaps with N\n"
+            "              rather than a random seed.\n",
+            UNTIL_CI_MIN_RUNS, RATE_DEFAULT_SLOTS);
 
     if (! longhelp) {
         fprintf(stderr,
@@ -110,116 +241,383 @@ void usage(unsigned int longhelp) {
         "  - process exit status and resource usage (see wait4(2)).\n"
         "  - temporary files stdout_XXXXXX and stderr_XXXXXX are created in the\n"
         "    current working directory (for random values of XXXXXX) for each\n"
-        "    command run; the corresponding filenames are in the final fields.\n");
+        "    command run; the corresponding filenames are in the final fields.\n"
+        "    Compressed streams are piped through the measuring process and\n"
+        "    written to files suffixed with .gz or .zst.\n"
+        "  - with --store, the stdout and stderr fields are instead the SHA-256\n"
+        "    of the output, stored as DIR/objects/ab/cdef... (plus any .gz or\n"
+        "    .zst suffix), and the header has a store= line.\n"
+        "  - in hash capture mode the stdout or stderr field is the SHA-256 of\n"
+        "    the stream, in count mode it's '-'.\n"
+        "  - stdout_bytes and stderr_bytes count the (uncompressed) bytes\n"
+        "    written to each stream.\n"
+        "  - with --perf, hardware counter fields follow (scaled up if they\n"
+        "    had to be multiplexed), then perf_scale, the fraction in parts per\n"
+        "    million of the run that the counters were actually counting;\n"
+        "    unavailable counters are '-'.  The header's perf= line says\n"
+        "    whether counters include the kernel (all), only user space\n"
+        "    (user) or are unavailable; with -p, partial if some threads\n"
+        "    couldn't be given counters, and so none are counted.\n"
+        "  - the header records the execution environment options given:\n"
+        "    cpus=, nice=, sched=, aslr=off and numa=.\n"
+        "  - with --param, a param_NAME field of each parameter's value, and a\n"
+        "    param[i]= header line of each as given.\n"
+        "  - with --compare, the variant field says which command each run\n"
+        "    was of, 0 for the first and 1 for the second, and the header\n"
+        "    describes the second with compare_prog= and compare_argv[i]=,\n"
+        "    and the order's seed with compare_seed=.\n"
+        "  - with --cache, the read_bytes field has the bytes each run read from\n"
+        "    disk, and the header the cache mode with cache=, whether the\n"
+        "    whole page cache was dropped with cache_drop= and the files\n"
+        "    with cache_file[i]=.\n"
+        "  - with --exec-time, the exec_to_exit and fork_to_exit fields have\n"
+        "    the ns from when execv() succeeded, and from just before fork(),\n"
+        "    to the end time.\n"
+        "  - with --procstat, sched_runtime, sched_delay and sched_slices\n"
+        "    have the ns the command's main thread ran, and waited runnable,\n"
+        "    for a cpu, and how many times it ran; io_read_bytes,\n"
+        "    io_write_bytes, io_syscr and io_syscw its storage I/O and read\n"
+        "    and write calls; main_nvcsw and main_nivcsw its main thread's\n"
+        "    own voluntary and involuntary context switches.\n"
+        "  - with --noise, noise_cpu has the ns of cpu time used by other\n"
+        "    tasks during the run (in USER_HZ ticks), psi_cpu_usec,\n"
+        "    psi_memory_usec and psi_io_usec the time some task, the command\n"
+        "    included, was stalled on each, load_running the runnable tasks\n"
+        "    as it started, and vm_pgscan, vm_allocstall and vm_compact_stall\n"
+        "    the pages scanned for reclaim, direct reclaims and direct\n"
+        "    compactions.  With --noise-reject the header lists the limits\n"
+        "    with noise_reject[i]=, and the trailer has noise_rejected=, the\n"
+        "    number of runs run again for being over them.\n"
+        "  - with -p, each record covers one interval of the attached\n"
+        "    process, from start to end: utime, stime, the fault, context\n"
+        "    switch and procstat fields are what it used during the interval,\n"
+        "    summed over its threads, inblock and oublock its I/O bytes / 512\n"
+        "    and maxrss its resident size at the end.  The header has pid=,\n"
+        "    prog=, argv[i]= and interval=, and the trailer stopped=exited\n"
+        "    and runs=.\n"
+        "  - with --phases, the phase_fork, phase_setup, phase_reap and\n"
+        "    phase_collect fields have how long, in ns, measure took from\n"
+        "    fork() until the child ran, for the child to set up until its\n"
+        "    start time, to reap the child once its exit was noticed, and\n"
+        "    to collect its results after its end time.\n"
+        "  - with --calibrate, the header has the mean wallclock of the\n"
+        "    empty command in ns with overhead=, the half-width of its 95%%\n"
+        "    confidence interval with overhead_halfwidth=, and the command\n"
+        "    and number of runs with calibration_prog= and calibration_runs=.\n"
+        "  - with --timeline, the timeline field names each run's side file,\n"
+        "    in the binary format described below, with a record per sample\n"
+        "    of time (t), process count, memory sizes in bytes (vsize, rss,\n"
+        "    shared, pss, swap), cpu time and page faults.\n"
+        "  - with --cgroup, the leaf's peak memory, cpu usage and throttling,\n"
+        "    io bytes and peak number of pids follow as cg_* fields, '-' where\n"
+        "    the controller isn't enabled; processes left in the leaf once the\n"
+        "    command exits are killed.  The header's cgroup= line names DIR and\n"
+        "    cgroup_controllers= the controllers enabled for the leaves.\n"
+        "  - when sampling with -j or --pin, the slot and cpu (-1 if unpinned)\n"
+        "    that each run used are output after the filenames.\n"
+
+        "\nStatistics:\n"
+        "  - With --stats, a summary of every numeric field (and wallclock,\n"
+        "    but not the start and end times) is written on exit, even when\n"
+        "    killed by SIGPIPE, SIGINT or SIGTERM: the count, mean, stddev,\n"
+        "    min, max and percentiles of each, the percentiles estimated to\n"
+        "    within 3%% from a log-bucketed histogram.  The histograms and\n"
+        "    moments of summaries merge exactly, see stats.py.\n"
+
+        "\nStopping:\n"
+        "  - With --until-ci or --max-time the header records the targets\n"
+        "    (until_ci=, ci_metric=, max_runs=, max_time=), and once sampling\n"
+        "    finishes a trailer of key=value lines follows the records: why\n"
+        "    sampling stopped (stopped=ci, max-runs or max-time), the number of\n"
+        "    runs, and the achieved ci_mean, ci_halfwidth and ci_relative\n"
+        "    (halfwidth over mean) of the ci metric over all of the runs.\n"
+        "  - With --rate the header has rate_interval=, the mean ns between\n"
+        "    intended starts, and rate_arrivals=fixed or poisson (with\n"
+        "    rate_seed=), and the trailer has latency_p50=, latency_p99= and\n"
+        "    latency_p999=, in ns from the intended starts of recorded runs\n"
+        "    (from a histogram like --stats', so to within about 3%%).\n"
+        "  - With --warmup the header has a warmup_mode= line, and the trailer\n"
+        "    has warmup_discarded=, the number of runs that weren't recorded,\n"
+        "    and warmup_records=, how many of the leading records MSER-5 found\n"
+        "    to still be warming up.  Runs that aren't recorded don't count\n"
+        "    towards -n and their output files are removed; with -j, every run\n"
+        "    started while warming up is discarded, and with --compare the\n"
+        "    warm-up runs alternate the commands and the first recorded run\n"
+        "    starts a new pair.\n"
+
+        "\nBinary format:\n"
+        "  - The first line is \"" RECORD_BINARY_MAGIC "\", followed by the same\n"
+        "    key=value header lines as the text format, then a fields= line\n"
+        "    listing name:type pairs, a recsize= line and an empty line.\n"
+        "  - After NUL padding to an 8 byte boundary, fixed-size records\n"
+        "    follow; types are ns (times as int64 nanoseconds), i64 and sN (a\n"
+        "    NUL padded string of N bytes), all integers little-endian.\n"
+        "  - Any trailer starts with a \"" RECORD_TRAILER_MAGIC "\" line after\n"
+        "    the last record.\n");
 
     exit(0);
 }
 
-static struct program_result res = program_result_init();
-
-// Flag controlling whether res has been shipped down stdout, or not;
-// if not then we'll cleanup in response to a SIG{TERM,INT,HUP,PIPE} by
-// unlinking the std{out,err} files we created and killing the child
-// process.
-static int result_sent;
+// Results which haven't been shipped down stdout yet are cleaned up by the
+// pool in response to a SIG{TERM,INT,HUP,PIPE}, by unlinking the
+// std{out,err} files we created and killing any running children.
+static struct pool pool = pool_init();
 
 void cleanup_current_result(void) {
-    if (result_sent)
-        return;
-    if (res.stdout != NULL)
-        unlink(res.stdout);
-    if (res.stderr != NULL)
-        unlink(res.stderr);
-    if (res.pid != 0)
-        polite_kill(res.pid);
+    pool_cleanup(&pool);
 }
 
-int buffer_stdin(
-    struct program *prog,
+// Running statistics for --stats, written out on exit
+static struct stats stats = stats_init();
+static const char *statspath = NULL;
+
+void write_stats(void) {
+    char _errbuf[ERRBUF_SIZE];
+    struct error_buffer errbuf = {ERRBUF_SIZE-1, _errbuf};
+    if (statspath == NULL) {
+        stats_write(&stats, stderr);
+        fflush(stderr);
+    } else if (stats_save(&stats, statspath, &errbuf) < 0) {
+        fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+    }
+}
+
+// Copies the rest of stdin into a sealed memfd that then replaces it, so
+// every run reads the same bytes from memory; the child reopens it through
+// /proc, so each run gets its own offset. Pipes are spliced in, regular
+// files copied with copy_file_range() or sendfile(), only falling back to
+// read() and write() for anything else. With lock the buffer is also mapped
+// and mlock()ed so it can't be swapped out between runs.
+off_t buffer_stdin(
+    unsigned int lock,
     struct error_buffer *errbuf) {
 
-    char path[] = "stdin_XXXXXX";
-    int fd = mkstemp(path);
+    int fd = memfd_create("stdin", MFD_CLOEXEC | MFD_ALLOW_SEALING);
     if (fd < 0) {
         snprintf(errbuf->s, errbuf->n,
-            "mkstemp() failed for stdin_XXXXXX, %s", strerror(errno));
+            "memfd_create() failed, %s", strerror(errno));
         return -1;
     }
-    prog->stdin = strdup(path);
-    if (prog->stdin == NULL) {
-        strncpy(errbuf->s, "strdup() failed", errbuf->n);
-        return -1;
+
+    off_t size = 0;
+    int how = 0;
+    unsigned char buffer[BUFFER_SIZE];
+    for (;;) {
+        ssize_t got;
+        switch (how) {
+        case 0:
+            got = splice(STDIN_FILENO, NULL, fd, NULL,
+                STDIN_CHUNK_SIZE, SPLICE_F_MOVE);
+            break;
+        case 1:
+            got = copy_file_range(STDIN_FILENO, NULL, fd, NULL,
+                STDIN_CHUNK_SIZE, 0);
+            break;
+        case 2:
+            got = sendfile(fd, STDIN_FILENO, NULL, STDIN_CHUNK_SIZE);
+            break;
+        default:
+            got = read(STDIN_FILENO, buffer, BUFFER_SIZE);
+            if (got > 0 && write(fd, buffer, got) < got) {
+                snprintf(errbuf->s, errbuf->n,
+                    "write failed, %s", strerror(errno));
+                close(fd);
+                return -1;
+            }
+        }
+        if (got == 0) break;
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            if (how < 3 && (errno == EINVAL || errno == EXDEV ||
+                            errno == ENOSYS || errno == EOPNOTSUPP)) {
+                how++;
+                continue;
+            }
+            snprintf(errbuf->s, errbuf->n,
+                "reading stdin failed, %s", strerror(errno));
+            close(fd);
+            return -1;
+        }
+        size += got;
     }
 
-    if (fchmod(fd, S_IRUSR) < 0) {
-        snprintf(errbuf->s, errbuf->n, "fchmod() failed for %s, %s",
-            prog->path, strerror(errno));
+    if (fcntl(fd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "sealing stdin failed, %s", strerror(errno));
         close(fd);
         return -1;
     }
 
-    unsigned char buffer[BUFFER_SIZE];
-    for (;;) {
-        ssize_t got = read(STDIN_FILENO, buffer, BUFFER_SIZE);
-        if (got == 0) break;
-        if (fd < 0) {
+    // the mapping is never unmapped, it holds the lock until measure exits
+    if (lock && size > 0) {
+        void *mem = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED) {
             snprintf(errbuf->s, errbuf->n,
-                "read failed, %s", strerror(errno));
+                "mmap() failed, %s", strerror(errno));
             close(fd);
             return -1;
         }
-
-        ssize_t wrote = write(fd, buffer, got);
-        if (wrote < got) {
+        if (mlock(mem, size) < 0) {
             snprintf(errbuf->s, errbuf->n,
-                "write failed, %s", strerror(errno));
+                "mlock() of %lld bytes failed, %s (see ulimit -l)",
+                (long long) size, strerror(errno));
             close(fd);
             return -1;
         }
     }
+
+    if (lseek(fd, 0, SEEK_SET) < 0 || dup2(fd, STDIN_FILENO) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "replacing stdin failed, %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
     close(fd);
 
-    return 0;
+    return size;
 }
 
-char *gzip_file(const char *path, struct error_buffer *errbuf) {
-    size_t l = strlen(path);
-    char *gzpath = malloc(l + 4);
-    strcpy(gzpath, path);
-    strcpy((gzpath + l), ".gz");
+#define CALIBRATE_RUNS 30
 
-    pid_t gzippid;
-    int returncode;
-    pid_t rpid;
+// What a null command takes, from its start time to its end time, is all
+// measure's own overhead
+static struct stats_metric overhead = {"overhead", NULL};
 
-    fflush(stdout);
-    switch (gzippid = fork()) {
-    case -1:
-        snprintf(errbuf->s, errbuf->n,
-            "fork() failed, %s", strerror(errno));
-        return NULL;
-    case 0:
-        if (execlp("gzip", "gzip", path, NULL) < 0) {
-            fprintf(stderr,
-                "execlp(\"gzip\", \"gzip\", \"%s\") failed: %s\n",
-                path, strerror(errno));
-        }
-        exit(0xfe);
-    default:
-        rpid = waitpid(gzippid, &returncode, 0);
-        if (rpid == -1) {
-            snprintf(errbuf->s, errbuf->n,
-                "waitpid() failed, %s", strerror(errno));
-            return NULL;
+// Finds the empty command built alongside measure, falling back to true
+const char *calibrate_path(void) {
+    static char path[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 14);
+    if (n > 0) {
+        path[n] = '\0';
+        char *slash = rindex(path, '/');
+        if (slash != NULL) {
+            strcpy(slash, "/measure-null");
+            if (access(path, X_OK) == 0)
+                return path;
         }
-        if (returncode != 0) {
-            snprintf(errbuf->s, errbuf->n,
-                "gzip exited non-zero %i", returncode);
-            return NULL;
+    }
+    return "true";
+}
+
+// Runs nullprog n times through the pool, adding each run's wallclock to
+// overhead
+int calibrate(
+    struct pool *pool,
+    const struct program *nullprog,
+    int n,
+    struct error_buffer *errbuf) {
+
+    int started = 0;
+    for (int done=0; done<n; done++) {
+        while (started < n && pool->running < pool->nslots) {
+            if (pool_start(pool, nullprog, started, 0, errbuf) == NULL)
+                return -1;
+            started++;
         }
+        struct program_result *res = pool_wait(pool, errbuf);
+        if (res == NULL)
+            return -1;
+        stats_add_value(&overhead, stats_metric_value(&overhead, res));
+        program_result_discard(res);
+        pool_release(pool, res);
+    }
+    return 0;
+}
+
+static struct attach attached;
+
+// Records intervals of the already running process pid until it's gone,
+// see attach.h
+void measure_attached(
+    pid_t pid,
+    long interval,
+    unsigned int perf,
+    struct record_schema *schema,
+    struct error_buffer *errbuf) {
+
+    if (perf && perf_probe(errbuf) < 0) {
+        fprintf(stderr, "%s: perf counters unavailable, %s\n",
+            calledname, errbuf->s);
+        perf = 0;
     }
 
-    return gzpath;
+    if (attach_setup(&attached, pid, perf, errbuf) < 0 ||
+        record_schema_add(schema,
+            program_fields, program_nfields, errbuf) < 0 ||
+        record_schema_add(schema,
+            procstat_fields, procstat_nfields, errbuf) < 0 ||
+        (perf && record_schema_add(schema,
+            perf_fields, perf_nfields, errbuf) < 0)) {
+        fprintf(stderr, "%s: %s\n", calledname, errbuf->s);
+        exit(1);
+    }
+
+    record_header_start(schema);
+    record_info(schema, "pid=%i", pid);
+
+    char path[64], exe[PATH_MAX];
+    snprintf(path, sizeof(path), "/proc/%i/exe", pid);
+    ssize_t len = readlink(path, exe, sizeof(exe) - 1);
+    if (len > 0) {
+        exe[len] = '\0';
+        record_info(schema, "prog=%s", exe);
+    }
+
+    // the arguments are NUL separated, and may have been cut short
+    char cmdline[4096];
+    snprintf(path, sizeof(path), "/proc/%i/cmdline", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    len = fd < 0 ? -1 : read(fd, cmdline, sizeof(cmdline) - 1);
+    if (fd >= 0)
+        close(fd);
+    for (int off=0, j=0; off<len; j++) {
+        cmdline[len] = '\0';
+        record_info(schema, "argv[%i]=%s", j, cmdline + off);
+        off += strlen(cmdline + off) + 1;
+    }
+
+    record_info(schema, "interval=%ld", interval);
+    if (perf && attached.perf_partial)
+        fprintf(stderr, "%s: couldn't attach perf counters to every thread "
+            "of %i, recording none\n", calledname, pid);
+    if (perf)
+        record_info(schema, "perf=%s", attached.perf_partial ? "partial"
+            : perf_excludes_kernel() ? "user" : "all");
+    record_header_end(schema);
+    record_flush(schema);
+
+    setup_signal_handlers();
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    struct program_result res;
+    int n = 0;
+    while (! attached.exited) {
+        next.tv_sec  += (next.tv_nsec + interval) / 1000000000L;
+        next.tv_nsec  = (next.tv_nsec + interval) % 1000000000L;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL)
+               == EINTR);
+
+        program_result_reset(&res, NULL);
+        int r = attach_sample(&attached, &res, errbuf);
+        if (r < 0) {
+            fprintf(stderr, "%s: %s\n", calledname, errbuf->s);
+            exit(2);
+        }
+        if (r == 0)
+            break;
+        record_write(schema, &res);
+        record_flush(schema);
+        n++;
+    }
+    attach_close(&attached);
+
+    record_trailer_start(schema);
+    record_info(schema, "stopped=exited");
+    record_info(schema, "runs=%i", n);
+    record_flush(schema);
+    exit(0);
 }
 
 int main(unsigned int argc, const char *argv[]) {
@@ -233,10 +631,40 @@ int main(unsigned int argc, const char *argv[]) {
         calledname = argv[0];
 
     unsigned int printusage = 0;
-    unsigned int compressstdout = 0;
-    unsigned int compressstderr = 0;
+    unsigned int perf = 0;
+    unsigned int dostats = 0;
+    int statsevery = 0;
+    const char *untilci = NULL;
+    double ciwidth = 0, confidence = 0.95;
+    const char *cimetric = "wallclock";
+    long maxtime = 0;
+    const char *warmupmode = NULL;
+    int warmupfixed = -1;
+    unsigned int compare = 0;
+    unsigned int seed = 0, hasseed = 0;
+    struct program compareprog;
+    struct cache cache = cache_init();
+    struct template_params params = template_params_init();
+    int calibrateruns = 0;
+    struct program nullprog;
+    unsigned int cgroup = 0;
+    const char *cgroupdir = NULL;
     int nrecords = -1;
+    int nslots = -1;
+    struct rate rate = rate_init();
+    unsigned int pin = 0;
+    unsigned int pipelined = 0;
+    pid_t attachpid = 0;
+    long attachinterval = ATTACH_INTERVAL;
+    unsigned int noisy = 0;
+    struct noise_limits noiselimits = noise_limits_init();
+    struct pipeline pipeline;
+    unsigned int preloadstdin = 0;
+    off_t stdinbytes = -1;
     struct program prog = program_init();
+    struct record_schema schema = record_schema_init();
+    struct store store = store_init();
+    const char *storedir = NULL;
     prog.stdout = "stdout_XXXXXX";
     prog.stderr = "stderr_XXXXXX";
 
@@ -253,10 +681,173 @@ int main(unsigned int argc, const char *argv[]) {
                 usage(1);
             } else if (strcmp(argv[i], "--usage") == 0) {
                 printusage = 1;
-            } else if (strcmp(argv[i], "--compress-stdout") == 0) {
-                compressstdout = 1;
-            } else if (strcmp(argv[i], "--compress-stderr") == 0) {
-                compressstderr = 1;
+            } else if (strncmp(argv[i], "--compress-stdout", 17) == 0 ||
+                       strncmp(argv[i], "--compress-stderr", 17) == 0) {
+                struct capture_spec *spec = &prog.capture[
+                    argv[i][14] == 'o' ? PROGRAM_STDOUT : PROGRAM_STDERR];
+                if (argv[i][17] == '\0') {
+                    spec->codec = CAPTURE_CODEC_GZIP;
+                } else if (argv[i][17] != '=' ||
+                           capture_codec_parse(argv[i]+18,
+                               &spec->codec, &errbuf) < 0) {
+                    fprintf(stderr, "%s: invalid option '%s', %s\n",
+                        calledname, argv[i],
+                        argv[i][17] == '=' ? errbuf.s : "expected =codec");
+                    exit(1);
+                }
+            } else if (strncmp(argv[i], "--capture-stdout=", 17) == 0 ||
+                       strncmp(argv[i], "--capture-stderr=", 17) == 0) {
+                struct capture_spec *spec = &prog.capture[
+                    argv[i][13] == 'o' ? PROGRAM_STDOUT : PROGRAM_STDERR];
+                if (capture_mode_parse(argv[i]+17, spec, &errbuf) < 0) {
+                    fprintf(stderr, "%s: invalid option '%s', %s\n",
+                        calledname, argv[i], errbuf.s);
+                    exit(1);
+                }
+            } else if (strcmp(argv[i], "--memfd") == 0 ||
+                       strncmp(argv[i], "--memfd=", 8) == 0) {
+                size_t limit = CAPTURE_MEMLIMIT;
+                if (argv[i][7] == '=') {
+                    char *end;
+                    limit = strtoul(argv[i]+8, &end, 10);
+                    switch (*end) {
+                    case 'G': limit <<= 10;
+                        // fallthrough
+                    case 'M': limit <<= 10;
+                        // fallthrough
+                    case 'k': limit <<= 10; end++;
+                    }
+                    // at 0 every byte would be spilled to a file
+                    if (end == argv[i]+8 || *end != '\0' || limit == 0 ||
+                        argv[i][8] == '-') {
+                        fprintf(stderr, "%s: invalid option '%s', expected a "
+                            "positive byte count\n", calledname, argv[i]);
+                        exit(1);
+                    }
+                }
+                for (int j=0; j<2; j++) {
+                    prog.capture[j].memfd    = 1;
+                    prog.capture[j].memlimit = limit;
+                }
+            } else if (strcmp(argv[i], "--preload-stdin") == 0) {
+                preloadstdin = 1;
+            } else if (strncmp(argv[i], "--compress-level=", 17) == 0) {
+                int level = atoi(argv[i]+17);
+                prog.capture[PROGRAM_STDOUT].level = level;
+                prog.capture[PROGRAM_STDERR].level = level;
+            } else if (strncmp(argv[i], "--cpus=", 7) == 0 ||
+                       strncmp(argv[i], "--sched=", 8) == 0 ||
+                       strncmp(argv[i], "--numa=", 7) == 0) {
+                const char *arg = strchr(argv[i], '=') + 1;
+                int r = argv[i][2] == 'c'
+                    ? execenv_parse_cpus(&prog.env, arg, &errbuf)
+                    : argv[i][2] == 's'
+                    ? execenv_parse_sched(&prog.env, arg, &errbuf)
+                    : execenv_parse_numa(&prog.env, arg, &errbuf);
+                if (r < 0) {
+                    fprintf(stderr, "%s: invalid option '%s', %s\n",
+                        calledname, argv[i], errbuf.s);
+                    exit(1);
+                }
+            } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+                if (cache_parse(&cache, argv[i]+8, &errbuf) < 0) {
+                    fprintf(stderr, "%s: invalid option '%s', %s\n",
+                        calledname, argv[i], errbuf.s);
+                    exit(1);
+                }
+            } else if (strncmp(argv[i], "--cache-file=", 13) == 0) {
+                if (cache_add(&cache, argv[i]+13, &errbuf) < 0) {
+                    fprintf(stderr, "%s: invalid option '%s', %s\n",
+                        calledname, argv[i], errbuf.s);
+                    exit(1);
+                }
+            } else if (strncmp(argv[i], "--nice=", 7) == 0) {
+                prog.env.hasnice = 1;
+                prog.env.nice = atoi(argv[i]+7);
+            } else if (strcmp(argv[i], "--no-aslr") == 0) {
+                prog.env.norandomize = 1;
+            } else if (strcmp(argv[i], "--exec-time") == 0) {
+                prog.exectime = 1;
+            } else if (strcmp(argv[i], "--phases") == 0) {
+                prog.phases = 1;
+            } else if (strncmp(argv[i], "-p", 2) == 0) {
+                const char *arg = argv[i][2] != '\0' ? argv[i]+2
+                    : i+1 < argc ? argv[++i] : "";
+                attachpid = atoi(arg);
+                if (attachpid <= 0) {
+                    fprintf(stderr, "%s: invalid argument for -p\n",
+                        calledname);
+                    exit(1);
+                }
+            } else if (strncmp(argv[i], "--interval=", 11) == 0) {
+                if (duration_parse(argv[i]+11,
+                        &attachinterval, &errbuf) < 0 ||
+                    attachinterval <= 0) {
+                    fprintf(stderr, "%s: invalid option '%s', %s\n",
+                        calledname, argv[i], attachinterval <= 0
+                        ? "expected a positive duration" : errbuf.s);
+                    exit(1);
+                }
+            } else if (strcmp(argv[i], "--noise") == 0) {
+                noisy = 1;
+            } else if (strncmp(argv[i], "--noise-reject=", 15) == 0) {
+                if (noise_limit_parse(&noiselimits, argv[i]+15, &errbuf) < 0) {
+                    fprintf(stderr, "%s: invalid option '%s', %s\n",
+                        calledname, argv[i], errbuf.s);
+                    exit(1);
+                }
+                noisy = 1;
+            } else if (strcmp(argv[i], "--procstat") == 0) {
+                prog.procstat = 1;
+            } else if (strcmp(argv[i], "--calibrate") == 0) {
+                calibrateruns = CALIBRATE_RUNS;
+            } else if (strncmp(argv[i], "--calibrate=", 12) == 0) {
+                calibrateruns = atoi(argv[i]+12);
+                if (calibrateruns < 2) {
+                    fprintf(stderr, "%s: invalid option '%s', need at least "
+                        "two calibration runs\n", calledname, argv[i]);
+                    exit(1);
+                }
+            } else if (strcmp(argv[i], "--perf") == 0) {
+                perf = 1;
+            } else if (strcmp(argv[i], "--cgroup") == 0) {
+                cgroup = 1;
+            } else if (strncmp(argv[i], "--cgroup=", 9) == 0) {
+                cgroup = 1;
+                cgroupdir = argv[i]+9;
+            } else if (strcmp(argv[i], "--stats") == 0) {
+                dostats = 1;
+            } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+                dostats = 1;
+                statspath = argv[i]+8;
+            } else if (strncmp(argv[i], "--stats-every=", 14) == 0) {
+                dostats = 1;
+                statsevery = atoi(argv[i]+14);
+                if (statsevery < 1) {
+                    fprintf(stderr, "%s: invalid option '%s'\n",
+                        calledname, argv[i]);
+                    exit(1);
+                }
+            } else if (strncmp(argv[i], "--timeline=", 11) == 0) {
+                if (duration_parse(argv[i]+11,
+                        &prog.interval, &errbuf) < 0) {
+                    fprintf(stderr, "%s: invalid option '%s', %s\n",
+                        calledname, argv[i], errbuf.s);
+                    exit(1);
+                }
+                prog.timeline = "timeline_XXXXXX";
+            } else if (strncmp(argv[i], "--store=", 8) == 0) {
+                storedir = argv[i]+8;
+            } else if (strncmp(argv[i], "--format=", 9) == 0) {
+                if (strcmp(argv[i]+9, "text") == 0) {
+                    schema.format = RECORD_FORMAT_TEXT;
+                } else if (strcmp(argv[i]+9, "binary") == 0) {
+                    schema.format = RECORD_FORMAT_BINARY;
+                } else {
+                    fprintf(stderr, "%s: invalid format '%s'\n",
+                        calledname, argv[i]+9);
+                    exit(1);
+                }
             } else if (issample && strncmp(argv[i], "-n", 2) == 0) {
                 if (strlen(argv[i]) > 2) {
                     nrecords = atoi(argv[i]+2);
@@ -267,6 +858,90 @@ int main(unsigned int argc, const char *argv[]) {
                         calledname, argv[i]);
                     exit(1);
                 }
+            } else if (issample && strncmp(argv[i], "-j", 2) == 0) {
+                if (strlen(argv[i]) > 2) {
+                    nslots = atoi(argv[i]+2);
+                } else if (++i < argc) {
+                    nslots = atoi(argv[i]);
+                } else {
+                    fprintf(stderr, "%s: missing argument for -j\n",
+                        calledname);
+                    exit(1);
+                }
+                if (nslots < 1) {
+                    fprintf(stderr, "%s: invalid argument for -j\n",
+                        calledname);
+                    exit(1);
+                }
+            } else if (issample && strncmp(argv[i], "--rate=", 7) == 0) {
+                if (rate_parse(&rate, argv[i]+7, &errbuf) < 0) {
+                    fprintf(stderr, "%s: invalid option '%s', %s\n",
+                        calledname, argv[i], errbuf.s);
+                    exit(1);
+                }
+            } else if (issample && strcmp(argv[i], "--poisson") == 0) {
+                rate.poisson = 1;
+            } else if (issample && strcmp(argv[i], "--pin") == 0) {
+                pin = 1;
+            } else if (issample && strcmp(argv[i], "--pipeline") == 0) {
+                pipelined = 1;
+            } else if (issample && strncmp(argv[i], "--until-ci=", 11) == 0) {
+                char *end;
+                untilci = argv[i]+11;
+                ciwidth = strtod(untilci, &end);
+                if (*end == '%') {
+                    ciwidth /= 100;
+                    end++;
+                }
+                if (*end == '@')
+                    confidence = strtod(end+1, &end) / 100;
+                if (*end != '\0' || ciwidth <= 0 ||
+                    confidence <= 0 || confidence >= 1) {
+                    fprintf(stderr, "%s: invalid option '%s', "
+                        "expected e.g. --until-ci=1%%@95\n",
+                        calledname, argv[i]);
+                    exit(1);
+                }
+            } else if (issample && (strcmp(argv[i], "--param") == 0 ||
+                                    strncmp(argv[i], "--param=", 8) == 0)) {
+                const char *opt = argv[i];
+                const char *arg = opt[7] == '=' ? opt+8 : argv[++i];
+                if (arg == NULL) {
+                    fprintf(stderr, "%s: missing argument to %s\n",
+                        calledname, opt);
+                    exit(1);
+                }
+                if (template_param_parse(&params, arg, &errbuf) < 0) {
+                    fprintf(stderr, "%s: invalid parameter '%s', %s\n",
+                        calledname, arg, errbuf.s);
+                    exit(1);
+                }
+            } else if (issample && strcmp(argv[i], "--compare") == 0) {
+                compare = 1;
+            } else if (issample && strncmp(argv[i], "--seed=", 7) == 0) {
+                seed = strtoul(argv[i]+7, NULL, 10);
+                hasseed = 1;
+            } else if (issample && strncmp(argv[i], "--warmup=", 9) == 0) {
+                warmupmode = argv[i]+9;
+                if (strcmp(warmupmode, "auto") != 0 &&
+                    strcmp(warmupmode, "detect") != 0) {
+                    char *end;
+                    warmupfixed = strtol(warmupmode, &end, 10);
+                    if (*end != '\0' || end == warmupmode || warmupfixed < 0) {
+                        fprintf(stderr, "%s: invalid option '%s', "
+                            "expected auto, detect or a number of runs\n",
+                            calledname, argv[i]);
+                        exit(1);
+                    }
+                }
+            } else if (issample && strncmp(argv[i], "--ci-metric=", 12) == 0) {
+                cimetric = argv[i]+12;
+            } else if (issample && strncmp(argv[i], "--max-time=", 11) == 0) {
+                if (duration_parse(argv[i]+11, &maxtime, &errbuf) < 0) {
+                    fprintf(stderr, "%s: invalid option '%s', %s\n",
+                        calledname, argv[i], errbuf.s);
+                    exit(1);
+                }
             } else if (strcmp(argv[i], "--") == 0) {
                 i++;
                 break;
@@ -278,7 +953,35 @@ int main(unsigned int argc, const char *argv[]) {
         } else
             break;
 
-    if (i < argc && program_set_argv(&prog, argc-i, argv+i, &errbuf) != 0) {
+    // attached to a running process there's no command to run
+    if (attachpid > 0) {
+        if (i < argc) {
+            fprintf(stderr, "%s: -p takes no command\n", calledname);
+            exit(1);
+        }
+        measure_attached(attachpid, attachinterval, perf, &schema, &errbuf);
+    }
+
+    // with --compare, the second command follows a "---"
+    unsigned int comparei = argc;
+    if (compare) {
+        for (comparei=i; comparei<argc; comparei++)
+            if (strcmp(argv[comparei], "---") == 0)
+                break;
+        if (comparei + 1 >= argc || comparei == i) {
+            fprintf(stderr, "%s: --compare needs two commands separated "
+                "by ---\n", calledname);
+            exit(1);
+        }
+        if (untilci || (warmupmode && warmupfixed < 0)) {
+            fprintf(stderr, "%s: --compare can't be used with --until-ci or "
+                "--warmup=auto|detect\n", calledname);
+            exit(1);
+        }
+    }
+
+    if (i < argc &&
+        program_set_argv(&prog, comparei-i, argv+i, &errbuf) != 0) {
         fprintf(stderr, "%s: invalid command, %s\n", calledname, errbuf.s);
         exit(1);
     }
@@ -288,15 +991,24 @@ int main(unsigned int argc, const char *argv[]) {
         exit(1);
     }
 
+    prog.params = &params;
+    prog.templated = template_check(prog.argv, &params, &prog.usestmpdir,
+        &errbuf);
+    if (prog.templated < 0) {
+        fprintf(stderr, "%s: invalid command, %s\n", calledname, errbuf.s);
+        exit(1);
+    }
+
     if (isatty(STDIN_FILENO)) {
         prog.stdin = "/dev/null";
-    } else if (lseek(STDIN_FILENO, 0, SEEK_CUR) < 0) {
-        if (errno != ESPIPE) {
+    } else if (preloadstdin || lseek(STDIN_FILENO, 0, SEEK_CUR) < 0) {
+        if (! preloadstdin && errno != ESPIPE) {
             perror("lseek");
             exit(1);
         }
 
-        if (buffer_stdin(&prog, &errbuf) < 0) {
+        stdinbytes = buffer_stdin(preloadstdin, &errbuf);
+        if (stdinbytes < 0) {
             fprintf(stderr, "%s: failed to buffer stdin: %s\n",
                 calledname, errbuf.s);
             exit(1);
@@ -321,77 +1033,580 @@ int main(unsigned int argc, const char *argv[]) {
         }
     }
 
+    if (storedir != NULL) {
+        if (prog.capture[PROGRAM_STDOUT].memfd) {
+            fprintf(stderr, "%s: --memfd can't be used with --store\n",
+                calledname);
+            exit(1);
+        }
+        if (store_open(&store, storedir, &errbuf) < 0 ||
+            (schema.copy = store_open_run(&store, &errbuf)) == NULL) {
+            fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+            exit(1);
+        }
+        prog.capture[PROGRAM_STDOUT].store = &store;
+        prog.capture[PROGRAM_STDERR].store = &store;
+    }
+
+    if (perf) {
+        if (perf_probe(&errbuf) < 0)
+            fprintf(stderr, "%s: perf counters unavailable, %s\n",
+                calledname, errbuf.s);
+        else
+            prog.perf = 1;
+    }
+
+    if (cgroup) {
+        if (cgroup_setup(cgroupdir, &errbuf) < 0) {
+            fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+            exit(1);
+        }
+        prog.cgroup = 1;
+    }
+
+    if (rate.poisson && rate.interval == 0) {
+        fprintf(stderr, "%s: --poisson needs a --rate\n", calledname);
+        exit(1);
+    }
+    if (rate.poisson) {
+        if (! hasseed && getrandom(&seed, sizeof(seed), 0) != sizeof(seed))
+            seed = getpid() ^ time(NULL);
+        rate.seed = seed;
+    }
+    if (nslots < 0)
+        nslots = rate.interval > 0 ? RATE_DEFAULT_SLOTS : 1;
+
+    int *cpus = NULL;
+    if (pin) {
+        cpus = calloc(nslots, sizeof(int));
+        if (cpus == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+        int ncpus = topology_physical_cpus(cpus, nslots,
+            prog.env.cpulist != NULL ? &prog.env.cpus : NULL, &errbuf);
+        if (ncpus < 0) {
+            fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+            exit(1);
+        } else if (ncpus < nslots) {
+            fprintf(stderr, "%s: only %i physical cores available for -j %i\n",
+                calledname, ncpus, nslots);
+            exit(1);
+        }
+    }
+
+    // the worker keeps off the cores that runs are confined to, if any
+    cpu_set_t workercpus;
+    const cpu_set_t *workerpin = NULL;
+    if (pipelined) {
+        if (printusage) {
+            fprintf(stderr, "%s: --pipeline can't be used with --usage\n",
+                calledname);
+            exit(1);
+        }
+        cpu_set_t busy;
+        CPU_ZERO(&busy);
+        if (prog.env.cpulist != NULL)
+            CPU_OR(&busy, &busy, &prog.env.cpus);
+        for (int j=0; cpus != NULL && j<nslots; j++)
+            CPU_SET(cpus[j], &busy);
+        if (CPU_COUNT(&busy) > 0) {
+            int n = topology_spare_cpus(&workercpus, &busy, &errbuf);
+            if (n < 0) {
+                fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+                exit(1);
+            } else if (n == 0) {
+                fprintf(stderr, "%s: no cores left for the --pipeline "
+                    "worker, leaving it unpinned\n", calledname);
+            } else {
+                workerpin = &workercpus;
+            }
+        }
+    }
+
+    if (record_schema_add(&schema,
+            program_fields, program_nfields, &errbuf) < 0 ||
+        ((pin || nslots > 1) && record_schema_add(&schema,
+            pool_fields, pool_nfields, &errbuf) < 0) ||
+        (compare && record_schema_add(&schema,
+            compare_fields, compare_nfields, &errbuf) < 0) ||
+        template_schema_add(&params, &schema, &errbuf) < 0 ||
+        (prog.exectime && record_schema_add(&schema,
+            exec_fields, exec_nfields, &errbuf) < 0) ||
+        (prog.phases && record_schema_add(&schema,
+            phase_fields, phase_nfields, &errbuf) < 0) ||
+        (rate.interval > 0 && record_schema_add(&schema,
+            rate_fields, rate_nfields, &errbuf) < 0) ||
+        (cache.mode != CACHE_ANY && record_schema_add(&schema,
+            cache_fields, cache_nfields, &errbuf) < 0) ||
+        (perf && record_schema_add(&schema,
+            perf_fields, perf_nfields, &errbuf) < 0) ||
+        (prog.timeline != NULL && record_schema_add(&schema,
+            timeline_fields, timeline_nfields, &errbuf) < 0) ||
+        (cgroup && record_schema_add(&schema,
+            cgroup_fields, cgroup_nfields, &errbuf) < 0) ||
+        (prog.procstat && record_schema_add(&schema,
+            procstat_fields, procstat_nfields, &errbuf) < 0) ||
+        (noisy && record_schema_add(&schema,
+            noise_fields, noise_nfields, &errbuf) < 0)) {
+        fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+        exit(1);
+    }
+
+    // the second command of a comparison runs with all the same options
+    if (compare) {
+        compareprog = prog;
+        compareprog.path = NULL;
+        if (program_set_argv(&compareprog, argc-comparei-1, argv+comparei+1,
+                &errbuf) != 0) {
+            fprintf(stderr, "%s: invalid command, %s\n", calledname, errbuf.s);
+            exit(1);
+        }
+        if (! hasseed && getrandom(&seed, sizeof(seed), 0) != sizeof(seed))
+            seed = getpid() ^ time(NULL);
+        compareprog.templated = template_check(compareprog.argv, &params,
+            &compareprog.usestmpdir, &errbuf);
+        if (compareprog.templated < 0) {
+            fprintf(stderr, "%s: invalid command, %s\n",
+                calledname, errbuf.s);
+            exit(1);
+        }
+        if (nrecords >= 0)
+            nrecords *= 2;
+    }
+
+    // -n counts runs of each combination of parameter values
+    unsigned long ncombos = template_ncombos(&params);
+    if (nrecords >= 0)
+        nrecords *= ncombos;
+    if (ncombos > 1 && (untilci || (warmupmode && warmupfixed < 0))) {
+        fprintf(stderr, "%s: --param can't be used with --until-ci or "
+            "--warmup=auto|detect\n", calledname);
+        exit(1);
+    }
+
+    // the commands and their stdin, buffered or not, are inputs too
+    if (cache.mode != CACHE_ANY) {
+        struct stat s;
+        const char *stdinpath = prog.stdin;
+        if (stdinbytes >= 0)
+            stdinpath = NULL;
+        else if (stdinpath == NULL)
+            stdinpath = fstat(STDIN_FILENO, &s) == 0 && S_ISREG(s.st_mode)
+                ? "/dev/stdin" : NULL;
+        else if (strcmp(stdinpath, "/dev/null") == 0)
+            stdinpath = NULL;
+        if (cache_add(&cache, prog.path, &errbuf) < 0 ||
+            (compare && cache_add(&cache, compareprog.path, &errbuf) < 0) ||
+            (stdinpath != NULL &&
+             cache_add(&cache, stdinpath, &errbuf) < 0)) {
+            fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+            exit(1);
+        }
+        cache_setup(&cache);
+    }
+
+    // warm-up is detected both in the runs before recording starts (for
+    // --warmup=auto) and in the recorded runs themselves
+    struct warmup prewarmup = warmup_init(), warmup = warmup_init();
+    if (pool_setup(&pool, &prog, nslots, pipelined ? 2 : 1, cpus,
+            &errbuf) < 0 ||
+        ((dostats || untilci || warmupmode) &&
+         stats_setup(&stats, &schema, &errbuf) < 0) ||
+        (warmupmode && (warmup_setup(&prewarmup, &errbuf) < 0 ||
+                        warmup_setup(&warmup, &errbuf) < 0))) {
+        fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+        exit(1);
+    }
+
+    struct stats_metric *cistats = NULL;
+    if ((untilci || warmupmode) &&
+        (cistats = stats_find(&stats, cimetric)) == NULL) {
+        fprintf(stderr, "%s: no numeric field %s for --ci-metric\n",
+            calledname, cimetric);
+        exit(1);
+    }
+
     atexit(cleanup_current_result);
+    if (dostats)
+        atexit(write_stats);
 
     setup_signal_handlers();
 
+    // calibration runs are like any other, just of nothing
+    if (calibrateruns > 0) {
+        const char *nullargv[] = {calibrate_path()};
+        nullprog = prog;
+        nullprog.path = NULL;
+        nullprog.templated = nullprog.usestmpdir = 0;
+        if (program_set_argv(&nullprog, 1, nullargv, &errbuf) < 0 ||
+            calibrate(&pool, &nullprog, calibrateruns, &errbuf) < 0) {
+            fprintf(stderr, "%s: calibration failed, %s\n",
+                calledname, errbuf.s);
+            exit(2);
+        }
+    }
+
+    record_header_start(&schema);
+
     if (prog.stdin != NULL)
-        printf("stdin=%s\n", prog.stdin);
+        record_info(&schema, "stdin=%s", prog.stdin);
+    if (stdinbytes >= 0) {
+        record_info(&schema, "stdin=%s",
+            preloadstdin ? "memfd:locked" : "memfd");
+        record_info(&schema, "stdin_bytes=%lld", (long long) stdinbytes);
+    }
 
-    printf("prog=%s\n", prog.path);
+    record_info(&schema, "prog=%s", prog.path);
 
     const char **args = prog.argv;
     i = 0;
     while (*args != NULL) {
-        printf("argv[%i]=%s\n", i, *args);
+        record_info(&schema, "argv[%i]=%s", i, *args);
         args++;
         i++;
     }
 
+    if (compare) {
+        record_info(&schema, "compare_prog=%s", compareprog.path);
+        for (i=0; compareprog.argv[i] != NULL; i++)
+            record_info(&schema, "compare_argv[%i]=%s",
+                i, compareprog.argv[i]);
+        record_info(&schema, "compare_seed=%u", seed);
+    }
+
+    for (i=0; i<params.nparams; i++)
+        record_info(&schema, "param[%i]=%s", i, params.params[i].arg);
+
+    execenv_info(&prog.env, &schema);
+
+    if (calibrateruns > 0) {
+        record_info(&schema, "calibration_prog=%s", nullprog.path);
+        record_info(&schema, "calibration_runs=%i", calibrateruns);
+        record_info(&schema, "overhead=%.0f", overhead.mean);
+        record_info(&schema, "overhead_halfwidth=%.0f",
+            stats_ci_halfwidth(&overhead, 0.95));
+    }
+    cache_info(&cache, &schema);
+
     if (printusage)
-        printf("hasusage=true\n");
+        record_info(&schema, "hasusage=true");
 
-    puts("start end utime stime maxrss ixrss idrss isrss minflt majflt "
-         "nswap inblock oublock msgsnd msgrcv nsignals nvcsw nivcsw "
-         "status stdout stderr");
-    fflush(stdout);
+    if (pipelined)
+        record_info(&schema, "pipeline=%s",
+            workerpin != NULL ? "pinned" : "unpinned");
 
-    int nrecord = 0;
-    while (nrecords < 0 || nrecord++ < nrecords) {
-        if (printusage) {
-            // usage before running program
-            memset(&res, 0, sizeof(struct program_result));
-            getrusage(RUSAGE_SELF, &res.rusage);
-            print_result(&res);
-            putchar('\n');
-            fflush(stdout);
+    if (store.dir != NULL)
+        record_info(&schema, "store=%s", store.dir);
+
+    if (perf)
+        record_info(&schema, "perf=%s", ! prog.perf ? "unavailable"
+            : perf_excludes_kernel() ? "user" : "all");
+
+    if (cgroup) {
+        record_info(&schema, "cgroup=%s", cgroup_dir());
+        record_info(&schema, "cgroup_controllers=%s", cgroup_controllers());
+    }
+
+    if (untilci) {
+        record_info(&schema, "until_ci=%s", untilci);
+        record_info(&schema, "ci_metric=%s", cimetric);
+    }
+    if (rate.interval > 0) {
+        record_info(&schema, "rate_interval=%ld", rate.interval);
+        record_info(&schema, "rate_arrivals=%s",
+            rate.poisson ? "poisson" : "fixed");
+        if (rate.poisson)
+            record_info(&schema, "rate_seed=%u", seed);
+    }
+    for (i=0; i<noiselimits.n; i++)
+        record_info(&schema, "noise_reject[%i]=%s", i, noiselimits.args[i]);
+    if (warmupmode)
+        record_info(&schema, "warmup_mode=%s", warmupmode);
+    if (untilci || maxtime > 0) {
+        if (nrecords >= 0)
+            record_info(&schema, "max_runs=%i", nrecords);
+        if (maxtime > 0)
+            record_info(&schema, "max_time=%ld", maxtime);
+    }
+
+    record_header_end(&schema);
+    record_flush(&schema);
+
+    if (pipelined && pipeline_start(&pipeline, &schema,
+            nslots * pool.depth, workerpin, &errbuf) < 0) {
+        fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+        exit(1);
+    }
+
+    if (rate.interval > 0)
+        rate_setup(&rate);
+
+    struct timespec began;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &began);
+
+    // why no more runs are being started, once that's so
+    const char *stopped = NULL;
+    int nstarted = 0;
+    // every run started, recorded or not, for {run}
+    unsigned long nruns = 0;
+    // runs are discarded rather than recorded until warmed up, and any run
+    // started while warming up is discarded, even if it finishes after
+    int warming = warmupmode != NULL &&
+        (warmupfixed > 0 || strcmp(warmupmode, "auto") == 0);
+    unsigned long nwarmup = 0;
+    int ndiscarded = 0;
+    // runs rejected as too noisy, all told and in a row
+    int nrejected = 0, nretried = 0;
+    // a rejected run is run again as the same command and combination of
+    // parameter values before any other; there can be no more of them
+    // waiting than there are slots, as each was running in one
+    struct retry {
+        const struct program *prog;
+        unsigned long combo;
+    } *retries = NULL;
+    int nretries = 0;
+    if (noiselimits.n > 0 &&
+        (retries = calloc(pool.nslots, sizeof(struct retry))) == NULL) {
+        fprintf(stderr, "%s: %s\n", calledname, strerror(errno));
+        exit(1);
+    }
+    // each command and combination is recorded -n times, counted to check
+    unsigned long *nrecorded = NULL;
+    if (nrecords >= 0 && (nrecorded = calloc(
+            (compare ? 2 : 1) * ncombos, sizeof(unsigned long))) == NULL) {
+        fprintf(stderr, "%s: %s\n", calledname, strerror(errno));
+        exit(1);
+    }
+    // --compare runs both commands in a random order within each pair, so
+    // that drifting noise affects both alike; the runs to be recorded take
+    // their turns at pairs and combinations of parameter values apart from
+    // the warm-up runs, so that each is recorded as often
+    const struct program *pair[2] = {&prog, &compareprog};
+    unsigned long nscheduled = 0;
+    for (;;) {
+        while (stopped == NULL && pool.running < pool.nslots) {
+            if (nrecords >= 0 && nstarted >= nrecords) {
+                stopped = "max-runs";
+                break;
+            }
+            if (maxtime > 0) {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+                if ((now.tv_sec - began.tv_sec) * 1000000000L +
+                    now.tv_nsec - began.tv_nsec >= maxtime) {
+                    stopped = "max-time";
+                    break;
+                }
+            }
+
+            // open-loop, runs start on their schedule however many are
+            // still in flight
+            if (rate.interval > 0) {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+                if (! rate_due(&rate, &now))
+                    break;
+            }
+
+            if (printusage) {
+                // usage before running program
+                struct program_result usage = program_result_init();
+                getrusage(RUSAGE_SELF, &usage.rusage);
+                record_write(&schema, &usage);
+                record_flush(&schema);
+            }
+
+            int warmstart = nretries == 0 && warming &&
+                (warmupfixed < 0 || nwarmup < (unsigned long) warmupfixed);
+            unsigned long turn = warmstart ? nwarmup : nscheduled;
+            const struct program *next = &prog;
+            unsigned long combo = (compare ? turn / 2 : turn) % ncombos;
+            int retry = nretries > 0;
+            if (retry) {
+                nretries--;
+                next  = retries[nretries].prog;
+                combo = retries[nretries].combo;
+            } else if (compare && warmstart) {
+                next = turn % 2 ? &compareprog : &prog;
+            } else if (compare) {
+                if (turn % 2 == 0) {
+                    int first = (rand_r(&seed) >> 8) & 1;
+                    pair[0] = first ? &compareprog : &prog;
+                    pair[1] = first ? &prog : &compareprog;
+                }
+                next = pair[turn % 2];
+            }
+
+            // the slot may still be holding its last result
+            if (pipelined && pipeline_reclaim(&pipeline, &pool, &errbuf) < 0) {
+                fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+                exit(2);
+            }
+
+            if (cache_prepare(&cache, &errbuf) < 0) {
+                fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+                exit(2);
+            }
+
+            // run program
+            struct program_result *started =
+                pool_start(&pool, next, nruns, combo, &errbuf);
+            if (started == NULL) {
+                fputs(errbuf.s, stderr);
+                fputc('\n', stderr);
+                exit(2);
+            }
+            started->variant = next == &compareprog;
+            if (rate.interval > 0)
+                rate_start(&rate, started);
+            if (noisy)
+                noise_begin(&started->noise);
+            if (warmstart) {
+                nwarmup++;
+            } else {
+                nstarted++;
+                if (! retry)
+                    nscheduled++;
+            }
+            nruns++;
         }
 
-        result_sent = 0;
-        // run program
-        if (program_run(&prog, &res, &errbuf) == NULL) {
+        // until the next run is due, if there's a slot for it
+        int scheduled = rate.interval > 0 && stopped == NULL &&
+            pool.running < pool.nslots;
+        if (pool.running == 0 && ! scheduled)
+            break;
+
+        int timedout = 0;
+        struct program_result *res = scheduled
+            ? pool_wait_until(&pool, &rate.next, &timedout, &errbuf)
+            : pool_wait(&pool, &errbuf);
+        if (res == NULL && timedout)
+            continue;
+        if (res == NULL) {
             fputs(errbuf.s, stderr);
             fputc('\n', stderr);
             exit(2);
         }
+        if (noisy)
+            noise_end(&res->noise, &res->rusage);
 
-        if (compressstdout) {
-            char *gzstdout = gzip_file(res.stdout, &errbuf);
-            if (gzstdout == NULL) {
-                fputs(errbuf.s, stderr);
-                fputc('\n', stderr);
-                exit(2);
+        if (res->run < nwarmup) {
+            ndiscarded++;
+            if (warming && warmupfixed >= 0) {
+                warming = ndiscarded < warmupfixed;
+            } else if (warming && ! warmup_add(&prewarmup,
+                           stats_metric_value(cistats, res))) {
+                fprintf(stderr, "%s: no steady state after %i runs, "
+                    "recording anyway\n", calledname, ndiscarded);
+                warming = 0;
+            } else if (warming) {
+                warming = warmup_truncation(&prewarmup) < 0;
             }
-            free((char *) res.stdout);
-            res.stdout = gzstdout;
+            program_result_discard(res);
+            pool_release(&pool, res);
+            continue;
         }
 
-        if (compressstderr) {
-            char *gzstderr = gzip_file(res.stderr, &errbuf);
-            if (gzstderr == NULL) {
-                fputs(errbuf.s, stderr);
-                fputc('\n', stderr);
+        const char *over = noise_exceeded(&noiselimits, res);
+        if (over != NULL && nretried < NOISE_MAX_RETRIES) {
+            nrejected++;
+            nretried++;
+            nstarted--;
+            retries[nretries].prog  = res->variant ? &compareprog : &prog;
+            retries[nretries].combo = res->combo;
+            nretries++;
+            // -n is only reached once this is run again
+            if (stopped != NULL && strcmp(stopped, "max-runs") == 0)
+                stopped = NULL;
+            program_result_discard(res);
+            pool_release(&pool, res);
+            continue;
+        } else if (over != NULL) {
+            fprintf(stderr, "%s: still over noise limit %s after %i runs, "
+                "recording anyway\n", calledname, over, nretried);
+        }
+        nretried = 0;
+        if (nrecorded != NULL)
+            nrecorded[res->variant * ncombos + res->combo]++;
+
+        if (warmupmode)
+            warmup_add(&warmup, stats_metric_value(cistats, res));
+        if (rate.interval > 0)
+            rate_finish(&rate, res);
+
+        if (dostats || untilci) {
+            stats_add(&stats, res);
+            if (dostats && statsevery > 0 && stats.nruns % statsevery == 0)
+                write_stats();
+        }
+        if (pipelined) {
+            if (pipeline_push(&pipeline, res, &errbuf) < 0) {
+                fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
                 exit(2);
             }
-            free((char *) res.stderr);
-            res.stderr = gzstderr;
+        } else {
+            if (program_result_keep(res, &errbuf) < 0) {
+                fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+                exit(2);
+            }
+            record_write(&schema, res);
+            record_flush(&schema);
+            pool_release(&pool, res);
         }
 
-        print_result(&res);
-        putchar('\n');
-        fflush(stdout);
-        result_sent = 1;
-        program_result_free(&res);
+        if (untilci && stopped == NULL && cistats->n >= UNTIL_CI_MIN_RUNS &&
+            stats_ci_halfwidth(cistats, confidence) <=
+                ciwidth * fabs(cistats->mean))
+            stopped = "ci";
+    }
+
+    if (pipelined && pipeline_finish(&pipeline, &pool, &errbuf) < 0) {
+        fprintf(stderr, "%s: %s\n", calledname, errbuf.s);
+        exit(2);
+    }
+
+    if (nrecorded != NULL && stopped != NULL &&
+        strcmp(stopped, "max-runs") == 0) {
+        long each = nrecords / ((compare ? 2 : 1) * ncombos);
+        for (unsigned long i=0; i<(compare ? 2 : 1) * ncombos; i++)
+            if (nrecorded[i] != (unsigned long) each) {
+                fprintf(stderr, "%s: recorded %lu runs of command %lu with "
+                    "parameter combination %lu rather than %li\n",
+                    calledname, nrecorded[i], i / ncombos, i % ncombos, each);
+                exit(2);
+            }
+    }
+
+    if (untilci || maxtime > 0 || warmupmode || rate.interval > 0 ||
+        noiselimits.n > 0) {
+        record_trailer_start(&schema);
+        record_info(&schema, "stopped=%s", stopped);
+        record_info(&schema, "runs=%i", nstarted);
+        if (untilci) {
+            double halfwidth = stats_ci_halfwidth(cistats, confidence);
+            record_info(&schema, "ci_mean=%.17g", cistats->mean);
+            record_info(&schema, "ci_halfwidth=%.17g", halfwidth);
+            record_info(&schema, "ci_relative=%.17g",
+                cistats->mean != 0 ? halfwidth / fabs(cistats->mean) : -1);
+        }
+        if (rate.interval > 0) {
+            record_info(&schema, "latency_p50=%lld",
+                (long long) stats_percentile(&rate.latency, 50));
+            record_info(&schema, "latency_p99=%lld",
+                (long long) stats_percentile(&rate.latency, 99));
+            record_info(&schema, "latency_p999=%lld",
+                (long long) stats_percentile(&rate.latency, 99.9));
+        }
+        if (noiselimits.n > 0)
+            record_info(&schema, "noise_rejected=%i", nrejected);
+        if (warmupmode) {
+            record_info(&schema, "warmup_discarded=%i", ndiscarded);
+            record_info(&schema, "warmup_records=%i",
+                warmup_best_truncation(&warmup));
+        }
+        record_flush(&schema);
     }
 
     // TODO: free things?
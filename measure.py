@@ -17,14 +17,23 @@
 
 import collections
 import errno
+import gzip
+import io
+import itertools
+import mmap
+import operator
 import os
 import re
+import subprocess
+import sys
+from array import array
 from collections import namedtuple
-from functools import wraps
+from functools import lru_cache, wraps
 from math import modf
 from operator import attrgetter, itemgetter
 
-__all__ = ('Run', 'Selector', 'Collector')
+__all__ = ('Run', 'BinaryRun', 'Store', 'load_run', 'open_output',
+           'Selector', 'Collector')
 
 # TODO: docstrings? comments? examples?
 
@@ -240,6 +249,8 @@ def match_digit(value):
 value_matchers = (match_digit, timeval.match, timespec.match)
 
 def parse_value(value):
+    if value == '-':
+        return None
     for matcher in value_matchers:
         match = matcher(value)
         if match is not None:
@@ -306,25 +317,45 @@ def maybe_path_exists(f):
 
 compose = lambda f, g: lambda x: f(g(x))
 
-class Run(named_records):
-    def __init__(self, lines):
-        self.runinfo = {}
-        self.runinfo['samplename'] = lines.name
-        for line in lines:
-            if '=' not in line: break
-            line = line.rstrip('\r\n')
-            key, val = line.split('=', 1)
-            armatch = re.match(r'(\w+)\[(\d+)\]$', key)
-            if armatch:
-                key, i = armatch.groups()
-                i = int(i)
-                ar = self.runinfo.setdefault(key, [])
-                while len(ar) < i+1:
-                    ar.append(None)
-                ar[i] = val
-            else:
-                self.runinfo[key] = val
-        super(Run, self).__init__(lines, initial_line=line)
+def open_output(path):
+    """Opens a captured output file for reading, decompressing transparently."""
+    if path.endswith('.gz'):
+        return gzip.open(path, 'rb')
+    if path.endswith('.zst'):
+        try:
+            import zstandard
+        except ImportError:
+            with open(path, 'rb'):
+                pass # raise any OSError the same as other outputs
+            data = subprocess.run(('zstd', '-dcq', path),
+                stdout=subprocess.PIPE, check=True).stdout
+            return io.BytesIO(data)
+        return zstandard.ZstdDecompressor().stream_reader(open(path, 'rb'))
+    return open(path, 'rb')
+
+def output_size(path):
+    """Returns the (uncompressed) size of a captured output file."""
+    if not path.endswith(('.gz', '.zst')):
+        return os.path.getsize(path)
+    size = 0
+    with open_output(path) as f:
+        for chunk in iter(lambda: f.read(65536), b''):
+            size += len(chunk)
+    return size
+
+class RunInfo(object):
+    def parse_info(self, line):
+        key, val = line.split('=', 1)
+        armatch = re.match(r'(\w+)\[(\d+)\]$', key)
+        if armatch:
+            key, i = armatch.groups()
+            i = int(i)
+            ar = self.runinfo.setdefault(key, [])
+            while len(ar) < i+1:
+                ar.append(None)
+            ar[i] = val
+        else:
+            self.runinfo[key] = val
 
     def __getattr__(self, name):
         try:
@@ -334,25 +365,76 @@ class Run(named_records):
         raise AttributeError('no %s in %s' % (
             name, self.__class__.__name__))
 
-    def results(self):
-        # TODO: support compressed output
+    def output_path(self):
+        if 'store' in self.runinfo:
+            return Store(self.store).object_path
+        return self.side_path()
 
+    def side_path(self):
+        """Resolves side files, named relative to the sample file."""
         if not re.match('<.+>$', self.samplename):
             basedir = os.path.dirname(os.path.realpath(self.samplename))
-            stdout_bytes = lambda r: os.path.join(basedir, r.stdout)
-            stderr_bytes = lambda r: os.path.join(basedir, r.stderr)
-        else:
-            stdout_bytes = attrgetter('stdout')
-            stderr_bytes = attrgetter('stderr')
-
-        stdout_bytes = maybe_path_exists(
-            compose(os.path.getsize, stdout_bytes))
-        stderr_bytes = maybe_path_exists(
-            compose(os.path.getsize, stderr_bytes))
-
-        results = Collector(
-            Selector('wallclock', lambda r: (r.end - r.start)),
-            Selector('cputime', lambda r: (r.utime + r.stime)),
+            return lambda name: os.path.join(basedir, name)
+        return lambda name: name
+
+    def open_output(self, name):
+        """Opens a record's stdout or stderr, given its field value."""
+        return open_output(self.output_path()(name))
+
+    def load_timeline(self, name):
+        """Loads a record's timeline side file, given its field value."""
+        return load_run(self.side_path()(name))
+
+    def timeline_peaker(self):
+        """Returns a function of a timeline field and start time giving the
+        peak rss and how long after start (in ns) it was reached."""
+        @lru_cache(maxsize=None)
+        def peak(name, start):
+            if name is None:
+                return None, None
+            try:
+                timeline = self.load_timeline(name)
+            except (OSError, ValueError):
+                return None, None
+            rss = list(timeline.column('rss'))
+            if not rss:
+                return None, None
+            i = max(range(len(rss)), key=rss.__getitem__)
+            if isinstance(start, timespec):
+                start = start.asint()
+            return rss[i], timeline.column('t')[i] - start
+        return peak
+
+    def warmup_records(self, results=None):
+        """How many leading records are warm-up, as found by sample's
+        --warmup or else by MSER-5 over wallclock."""
+        if 'warmup_records' in self.runinfo:
+            return int(self.runinfo['warmup_records'])
+        if results is None:
+            results = self.results()
+        return mser(v.asint() if isinstance(v, timespec) else v
+                    for v in results.wallclock)
+
+    def output_sizer(self):
+        size = maybe_path_exists(compose(output_size, self.output_path()))
+        return lambda name: None if name is None else size(name)
+
+    perf_counters = ('cycles', 'instructions', 'cache_misses',
+                     'branch_misses', 'stalled_frontend', 'stalled_backend')
+
+    def selectors(self):
+        fields = self.fields
+        selectors = [Selector('variant')] if 'variant' in fields else []
+        selectors.extend(
+            Selector(name) for name in fields if name.startswith('param_'))
+        if 'overhead' in self.runinfo:
+            overhead = timespec(*divmod(int(self.runinfo['overhead']), 10**9))
+            selectors.append(Selector('net_wallclock',
+                lambda end, start: end - start - overhead,
+                fields=('end', 'start')))
+        selectors += [
+            Selector('wallclock', operator.sub, fields=('end', 'start')),
+            Selector('cputime', operator.add, fields=('utime', 'stime')),
             Selector('maxrss'),
             Selector('minflt'),
             Selector('majflt'),
@@ -360,25 +442,433 @@ class Run(named_records):
             Selector('inblock'),
             Selector('oublock'),
             Selector('nvcsw'),
-            Selector('nivcsw'),
-            Selector('stdout_bytes', stdout_bytes),
-            Selector('stderr_bytes', stderr_bytes))
+            Selector('nivcsw')]
+
+        if 'stdout_bytes' in fields:
+            selectors.extend((
+                Selector('stdout_bytes'),
+                Selector('stderr_bytes')))
+        else:
+            output_size = self.output_sizer()
+            selectors.extend((
+                Selector('stdout_bytes', output_size, fields=('stdout',)),
+                Selector('stderr_bytes', output_size, fields=('stderr',))))
+
+        selectors.extend(
+            Selector(name) for name in fields
+            if name.endswith('_to_exit') or name.startswith('phase_'))
+
+        if 'read_bytes' in fields:
+            selectors.append(Selector('read_bytes'))
+
+        if 'latency' in fields:
+            selectors.extend((Selector('start_lag'), Selector('latency')))
+
+        if 'cycles' in fields:
+            selectors.extend(
+                Selector(name, available, fields=(name,))
+                for name in self.perf_counters)
+            selectors.append(
+                Selector('ipc', ratio, fields=('instructions', 'cycles')))
+
+        selectors.extend(
+            Selector(name, available, fields=(name,))
+            for name in fields if name.startswith('cg_'))
+
+        selectors.extend(
+            Selector(name, available, fields=(name,))
+            for name in fields
+            if name.startswith(('sched_', 'io_', 'main_n', 'noise_', 'psi_',
+                                'load_', 'vm_')))
+
+        if 'timeline' in fields:
+            peak = self.timeline_peaker()
+            selectors.extend((
+                Selector('peak_rss', lambda name, start: peak(name, start)[0],
+                    fields=('timeline', 'start')),
+                Selector('time_to_peak_rss',
+                    lambda name, start: peak(name, start)[1],
+                    fields=('timeline', 'start'))))
+
+        return selectors
+
+class Run(RunInfo, named_records):
+    def __init__(self, lines, name=None):
+        self.runinfo = {}
+        self.runinfo['samplename'] = lines.name if name is None else name
+        for line in lines:
+            if '=' not in line: break
+            self.parse_info(line.rstrip('\r\n'))
+        super(Run, self).__init__(lines, initial_line=line)
+        # any trailer follows the records
+        for i, line in enumerate(self.lines):
+            if '=' in line:
+                for line in self.lines[i:]:
+                    self.parse_info(line.rstrip('\r\n'))
+                del self.lines[i:]
+                break
+
+    def results(self):
+        results = Collector(*self.selectors())
         for record in self:
             results.add(record)
         return results
 
+class BinaryRun(RunInfo):
+    """A sample file written by measure --format=binary.
+
+    The file is mmap'd (when possible) and its columns are exposed as
+    strided memoryviews over the records, times being integer nanoseconds;
+    no per-record objects are created unless iterating records.
+    """
+
+    magic = b'measure-binary 1'
+    trailer_magic = b'measure-trailer 1\n'
+
+    def __init__(self, f, name=None):
+        self.runinfo = {}
+        self.runinfo['samplename'] = f.name if name is None else name
+        try:
+            buf = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        except (AttributeError, OSError, ValueError, io.UnsupportedOperation):
+            f.seek(0)
+            buf = f.read()
+        self.buf = buf
+
+        end = buf.find(b'\n\n')
+        if end < 0:
+            raise ValueError('unterminated binary header')
+        lines = bytes(buf[:end]).decode().split('\n')
+        if lines[0].encode() != self.magic:
+            raise ValueError('not a binary sample file')
+        for line in lines[1:]:
+            self.parse_info(line)
+        start = end + 2
+        start += -start % 8
+
+        fields, types = [], []
+        for field in self.runinfo.pop('fields').split():
+            name, typ = field.rsplit(':', 1)
+            fields.append(name)
+            types.append(typ)
+        self.fields = tuple(fields)
+        self.types = tuple(types)
+        self.recsize = int(self.runinfo.pop('recsize'))
+
+        self.offsets = []
+        off = 0
+        for typ in self.types:
+            self.offsets.append(off)
+            off += int(typ[1:]) if typ.startswith('s') else 8
+        if off != self.recsize:
+            raise ValueError('field sizes sum to %d, but recsize is %d' % (
+                off, self.recsize))
+
+        end = len(buf)
+        trailer = buf.rfind(self.trailer_magic, start)
+        while trailer >= 0 and (trailer - start) % self.recsize:
+            trailer = buf.rfind(self.trailer_magic, start, trailer)
+        if trailer >= 0:
+            lines = bytes(buf[trailer + len(self.trailer_magic):]).decode()
+            for line in lines.splitlines():
+                self.parse_info(line)
+            end = trailer
+
+        self.nrecords = (end - start) // self.recsize
+        self.data = memoryview(buf)[start:start + self.nrecords * self.recsize]
+        if sys.byteorder == 'little':
+            self.words = self.data.cast('q')
+        else:
+            words = array('q', self.data)
+            words.byteswap()
+            self.words = memoryview(words)
+
+    def __len__(self):
+        return self.nrecords
+
+    def column(self, name):
+        i = self.fields.index(name)
+        typ, off = self.types[i], self.offsets[i]
+        if typ.startswith('s'):
+            size = int(typ[1:])
+            return [
+                bytes(self.data[o:o + size]).rstrip(b'\0').decode() or None
+                for o in range(off, len(self.data), self.recsize)]
+        return self.words[off // 8::self.recsize // 8]
+
+    def __iter__(self):
+        record_class = create_record_class(self.fields)
+        columns = [self.column(name) for name in self.fields]
+        for row in zip(*columns):
+            yield tuple.__new__(record_class, row)
+
+    def results(self):
+        return Collector.from_columns(*(
+            (selector.name, selector.column(self))
+            for selector in self.selectors()))
+
+class Store(object):
+    """A content-addressed store of outputs, written by measure --store=DIR.
+
+    Outputs are named by the SHA-256 of their uncompressed content, which is
+    what records carry in their stdout and stderr fields.
+    """
+
+    suffixes = ('', '.gz', '.zst')
+
+    def __init__(self, path):
+        self.path = path
+
+    def object_path(self, hash):
+        base = os.path.join(self.path, 'objects', hash[:2], hash[2:])
+        for suffix in self.suffixes:
+            if os.path.exists(base + suffix):
+                return base + suffix
+        raise OSError(errno.ENOENT, 'no such object', hash)
+
+    def open(self, hash):
+        return open_output(self.object_path(hash))
+
+    def read(self, hash):
+        with self.open(hash) as f:
+            return f.read()
+
+    def runs(self):
+        rundir = os.path.join(self.path, 'runs')
+        for name in sorted(os.listdir(rundir)):
+            yield load_run(os.path.join(rundir, name))
+
+def load_run(f):
+    """Loads a text or binary sample file given a path or file object."""
+    if isinstance(f, str):
+        name = f
+        f = open(f, 'rb')
+    else:
+        name = f.name
+        f = getattr(f, 'buffer', f)
+    first = f.readline()
+    if first.rstrip(b'\n') == BinaryRun.magic:
+        if not f.seekable():
+            f = io.BytesIO(first + f.read())
+        return BinaryRun(f, name=name)
+    lines = io.TextIOWrapper(f)
+    return Run(itertools.chain([first.decode()], lines), name=name)
+
+def mser(values, batch=5):
+    """Finds the end of warm-up in values by MSER-5 (see warmup.h).
+
+    Returns the number of leading values that are warm-up: the truncation
+    point over batch means, of no more than half of them, minimizing the
+    variance of the remaining means over the square of how many remain.
+    """
+    values = [v for v in values if v is not None]
+    means = [sum(values[i:i + batch]) / batch
+             for i in range(0, len(values) - batch + 1, batch)]
+    if len(means) < 4:
+        return 0
+    best, bestd = None, 0
+    for d in range(len(means) // 2 + 1):
+        rest = means[d:]
+        mean = sum(rest) / len(rest)
+        score = sum((y - mean) ** 2 for y in rest) / len(rest) ** 2
+        if best is None or score < best:
+            best, bestd = score, d
+    return bestd * batch
+
+class StatsMetric(object):
+    """The running statistics of one metric in a Stats summary."""
+
+    def __init__(self, name, subbits, n=0, mean=0.0, m2=0.0,
+                 min=None, max=None, buckets=None):
+        self.name = name
+        self.subbits = subbits
+        self.n = n
+        self.mean = mean
+        self.m2 = m2
+        self.min = min
+        self.max = max
+        self.buckets = collections.Counter(buckets or ())
+
+    @classmethod
+    def parse(cls, line, subbits):
+        name, *pairs = line.split()
+        values = dict(pair.split('=', 1) for pair in pairs)
+        buckets = {}
+        if values.get('buckets'):
+            for pair in values['buckets'].split(','):
+                i, count = pair.split(':')
+                buckets[int(i)] = int(count)
+        return cls(name, subbits,
+            n=int(values['n']),
+            mean=float(values['mean']),
+            m2=float(values['m2']),
+            min=int(values['min']) if 'min' in values else None,
+            max=int(values['max']) if 'max' in values else None,
+            buckets=buckets)
+
+    def merge(self, other):
+        """Combines two metrics, see Chan et al.'s parallel variance."""
+        if other.subbits != self.subbits:
+            raise ValueError('can only merge histograms of equal subbits')
+        n = self.n + other.n
+        if n == 0:
+            return StatsMetric(self.name, self.subbits)
+        delta = other.mean - self.mean
+        mean = self.mean + delta * other.n / n
+        m2 = self.m2 + other.m2 + delta * delta * self.n * other.n / n
+        bounds = [x for x in (self.min, self.max, other.min, other.max)
+                  if x is not None]
+        return StatsMetric(self.name, self.subbits, n, mean, m2,
+            min(bounds) if bounds else None,
+            max(bounds) if bounds else None,
+            self.buckets + other.buckets)
+
+    @property
+    def stddev(self):
+        if self.n < 2:
+            return 0.0
+        return (self.m2 / (self.n - 1)) ** 0.5
+
+    def bucket_value(self, i):
+        """The middle of the range of values that fall in bucket i."""
+        count = 1 << self.subbits
+        if i < count:
+            return i
+        shift = (i >> self.subbits) - 1
+        low = (count + (i & (count - 1))) << shift
+        return low + ((1 << shift) >> 1)
+
+    def percentile(self, p):
+        if self.n == 0:
+            return None
+        rank = max(1, -(-p * self.n // 100))
+        seen = 0
+        for i in sorted(self.buckets):
+            seen += self.buckets[i]
+            if seen >= rank:
+                return min(max(self.bucket_value(i), self.min), self.max)
+        return self.max
+
+    def __str__(self):
+        parts = [self.name, 'n=%d' % self.n, 'mean=%.17g' % self.mean,
+                 'm2=%.17g' % self.m2, 'stddev=%.17g' % self.stddev]
+        if self.n:
+            parts.append('min=%d' % self.min)
+            parts.append('max=%d' % self.max)
+            parts.extend('p%s=%d' % (format(p, 'g'), self.percentile(p))
+                         for p in Stats.percentiles)
+        parts.append('buckets=' + ','.join(
+            '%d:%d' % (i, self.buckets[i]) for i in sorted(self.buckets)
+            if self.buckets[i]))
+        return ' '.join(parts)
+
+class Stats(object):
+    """A summary written by sample --stats.
+
+    Summaries of the same metrics merge exactly: histogram counts add and
+    the moments are combined, so summaries of separate runs of sample can
+    be treated as one.
+    """
+
+    magic = 'measure-stats 1'
+    percentiles = (50, 90, 99, 99.9)
+
+    def __init__(self, runs=0, subbits=5, metrics=()):
+        self.runs = runs
+        self.subbits = subbits
+        self.metrics = collections.OrderedDict(
+            (metric.name, metric) for metric in metrics)
+
+    @classmethod
+    def load(cls, f):
+        if isinstance(f, str):
+            with open(f) as f:
+                return cls.load(f)
+        lines = iter(f)
+        if next(lines).rstrip('\n') != cls.magic:
+            raise ValueError('not a stats summary')
+        info = {}
+        for line in lines:
+            key, sep, value = line.rstrip('\n').partition('=')
+            if ' ' in key or not sep:
+                lines = itertools.chain([line], lines)
+                break
+            info[key] = value
+        subbits = int(info['subbits'])
+        return cls(int(info['runs']), subbits,
+            (StatsMetric.parse(line, subbits) for line in lines
+             if line.strip()))
+
+    def merge(self, other):
+        if other.subbits != self.subbits:
+            raise ValueError('can only merge histograms of equal subbits')
+        metrics = []
+        for name, metric in self.metrics.items():
+            if name in other.metrics:
+                metric = metric.merge(other.metrics[name])
+            metrics.append(metric)
+        metrics.extend(metric for name, metric in other.metrics.items()
+                       if name not in self.metrics)
+        return Stats(self.runs + other.runs, self.subbits, metrics)
+
+    def __getitem__(self, name):
+        return self.metrics[name]
+
+    def __str__(self):
+        return '\n'.join(itertools.chain(
+            (self.magic, 'runs=%d' % self.runs, 'subbits=%d' % self.subbits),
+            map(str, self.metrics.values())))
+
+def available(value):
+    """Maps unavailable (negative) counters to None."""
+    if value is None or value < 0:
+        return None
+    return value
+
+def ratio(a, b):
+    a, b = available(a), available(b)
+    if a is None or not b:
+        return None
+    return a / b
+
 class Selector(object):
-    def __init__(self, name, f=None):
+    """Selects a value from each record.
+
+    By default the value is the field called name; if fields are given,
+    the value is f applied to those fields' values, otherwise f is applied
+    to the whole record.
+    """
+
+    def __init__(self, name, f=None, fields=None):
         self.name = name
+        self.fields = fields
+        if fields is not None:
+            getter = attrgetter(*fields)
+            if len(fields) == 1:
+                self.f = lambda r: f(getter(r))
+            else:
+                self.f = lambda r: f(*getter(r))
+            self.combine = f
+            return
         if f is None:
             f = name
         if isinstance(f, str):
+            self.fields = (f,)
+            self.combine = None
             f = attrgetter(f)
         self.f = f
 
     def __call__(self, r):
         return self.f(r)
 
+    def column(self, run):
+        """Selects a whole column at once from a columnar run."""
+        if self.fields is None:
+            return map(self.f, run)
+        if self.combine is None:
+            return run.column(self.fields[0])
+        return map(self.combine, *map(run.column, self.fields))
+
 class Collector(tuple):
     def __new__(cls, *selectors, container=list):
         self = super(Collector, cls).__new__(cls, (
@@ -397,6 +887,15 @@ class Collector(tuple):
         raise AttributeError('no %s in %s' % (
             name, self.__class__.__name__))
 
+    @classmethod
+    def from_columns(cls, *columns, container=list):
+        names, columns = zip(*columns)
+        self = super(Collector, cls).__new__(cls, (
+            container(column) for column in columns))
+        self.fields = names
+        self.selectors = ()
+        return self
+
     def add(self, value):
         for sample, selector in zip(self, self.selectors):
             sample.append(selector(value))
@@ -404,19 +903,31 @@ class Collector(tuple):
 if __name__ == '__main__':
     import argparse
     parser = argparse.ArgumentParser()
-    parser.add_argument('files', metavar='FILE',
-        type=argparse.FileType('r'), nargs='*',
+    parser.add_argument('--warmup', '-w', action='store_true',
+        help='Add a warmup column marking warm-up records')
+    parser.add_argument('--trim', action='store_true',
+        help='Leave out warm-up records')
+    parser.add_argument('files', metavar='FILE', nargs='*',
         help='Sample files to read, use STDIN if none given')
     args = parser.parse_args()
 
     fields = None
-    for i, run in enumerate(map(Run, args.files)):
+    for i, run in enumerate(map(load_run, args.files or [sys.stdin])):
         results = run.results()
         runfields = results.fields
+        if args.warmup:
+            runfields += ('warmup',)
         if i == 0:
             fields = runfields
             print('samplename', *fields)
         else:
             assert runfields == fields
-        for row in zip(*results):
+        warmup = 0
+        if args.warmup or args.trim:
+            warmup = run.warmup_records(results)
+        for j, row in enumerate(zip(*results)):
+            if args.trim and j < warmup:
+                continue
+            if args.warmup:
+                row += (int(j < warmup),)
             print(run.samplename, *row)
@@ -0,0 +1,171 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "noise.h"
+#include "procstat.h"
+#include "record.h"
+
+// Only ever used from the main thread
+static char buffer[NOISE_BUFFER_SIZE];
+
+// ns of user and system time in ru
+static long noise_cputime(const struct rusage *ru) {
+    return (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000000L +
+        (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) * 1000L;
+}
+
+static void noise_sample(struct noise_sample *s) {
+    struct rusage self;
+    getrusage(RUSAGE_SELF, &self);
+    s->self = noise_cputime(&self);
+
+    // the first line sums all cpus: user nice system idle iowait irq
+    // softirq steal ..., guest time being included in user and nice
+    s->busy = -1;
+    if (procstat_file(buffer, sizeof(buffer), "/proc/stat") >= 0) {
+        long t[8];
+        if (sscanf(buffer, "cpu %ld %ld %ld %ld %ld %ld %ld %ld",
+                &t[0], &t[1], &t[2], &t[3], &t[4], &t[5], &t[6], &t[7]) == 8)
+            s->busy = t[0] + t[1] + t[2] + t[5] + t[6] + t[7];
+    }
+
+    static const char *pressure[] = {
+        "/proc/pressure/cpu", "/proc/pressure/memory", "/proc/pressure/io"};
+    for (int i=0; i<3; i++) {
+        char *total;
+        s->psi[i] = -1;
+        if (procstat_file(buffer, sizeof(buffer), "%s", pressure[i]) >= 0 &&
+            strncmp(buffer, "some ", 5) == 0 &&
+            (total = strstr(buffer, "total=")) != NULL)
+            s->psi[i] = strtol(total + 6, NULL, 10);
+    }
+
+    s->pgscan = s->allocstall = s->compact_stall = -1;
+    if (procstat_file(buffer, sizeof(buffer), "/proc/vmstat") >= 0) {
+        s->pgscan = s->allocstall = s->compact_stall = 0;
+        for (char *line = buffer; line != NULL && *line != '\0'; ) {
+            char *value = strchr(line, ' ');
+            if (value == NULL)
+                break;
+            *value = '\0';
+            long v = strtol(value + 1, NULL, 10);
+            if (strcmp(line, "pgscan_kswapd") == 0 ||
+                strcmp(line, "pgscan_direct") == 0 ||
+                strcmp(line, "pgscan_khugepaged") == 0 ||
+                strcmp(line, "pgscan_proactive") == 0)
+                s->pgscan += v;
+            else if (strncmp(line, "allocstall_", 11) == 0)
+                s->allocstall += v;
+            else if (strcmp(line, "compact_stall") == 0)
+                s->compact_stall += v;
+            line = strchr(value + 1, '\n');
+            if (line != NULL)
+                line++;
+        }
+    }
+}
+
+void noise_begin(struct noise *n) {
+    noise_sample(&n->before);
+
+    // "1.00 0.50 0.25 running/total lastpid"
+    n->running = -1;
+    if (procstat_file(buffer, sizeof(buffer), "/proc/loadavg") >= 0)
+        sscanf(buffer, "%*s %*s %*s %ld/", &n->running);
+}
+
+// after - before, or -1 if either is unavailable
+static long noise_delta(long before, long after) {
+    return before < 0 || after < 0 ? -1 : after - before;
+}
+
+void noise_end(struct noise *n, const struct rusage *ru) {
+    struct noise_sample after;
+    noise_sample(&after);
+
+    n->cpu = noise_delta(n->before.busy, after.busy);
+    if (n->cpu >= 0) {
+        n->cpu = n->cpu * (1000000000L / sysconf(_SC_CLK_TCK)) -
+            noise_cputime(ru) - (after.self - n->before.self);
+        if (n->cpu < 0)
+            n->cpu = 0;
+    }
+
+    n->psi_cpu       = noise_delta(n->before.psi[NOISE_PSI_CPU],
+                                   after.psi[NOISE_PSI_CPU]);
+    n->psi_memory    = noise_delta(n->before.psi[NOISE_PSI_MEMORY],
+                                   after.psi[NOISE_PSI_MEMORY]);
+    n->psi_io        = noise_delta(n->before.psi[NOISE_PSI_IO],
+                                   after.psi[NOISE_PSI_IO]);
+    n->pgscan        = noise_delta(n->before.pgscan, after.pgscan);
+    n->allocstall    = noise_delta(n->before.allocstall, after.allocstall);
+    n->compact_stall = noise_delta(n->before.compact_stall,
+                                   after.compact_stall);
+}
+
+int noise_limit_parse(
+    struct noise_limits *limits,
+    const char *arg,
+    struct error_buffer *errbuf) {
+
+    if (limits->n >= NOISE_MAX_LIMITS) {
+        snprintf(errbuf->s, errbuf->n,
+            "too many noise limits, at most %i", NOISE_MAX_LIMITS);
+        return -1;
+    }
+
+    const char *colon = strchr(arg, ':');
+    const struct record_field *field = NULL;
+    for (int i=0; colon != NULL && i<noise_nfields; i++)
+        if (strlen(noise_fields[i].name) == colon - arg &&
+            strncmp(noise_fields[i].name, arg, colon - arg) == 0)
+            field = &noise_fields[i];
+    char *end = NULL;
+    long max = field != NULL ? strtol(colon + 1, &end, 10) : 0;
+    if (field == NULL || end == colon + 1 || *end != '\0' || max < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "invalid noise limit \"%s\", expected e.g. psi_cpu_usec:1000",
+            arg);
+        return -1;
+    }
+
+    limits->fields[limits->n] = field;
+    limits->max[limits->n]    = max;
+    limits->args[limits->n]   = arg;
+    limits->n++;
+    return 0;
+}
+
+const char *noise_exceeded(
+    const struct noise_limits *limits,
+    const struct program_result *res) {
+
+    for (int i=0; i<limits->n; i++) {
+        long v = *(const long *) ((const char *) res +
+            limits->fields[i]->offset);
+        if (v > limits->max[i])
+            return limits->args[i];
+    }
+    return NULL;
+}
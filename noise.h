@@ -0,0 +1,103 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NOISE_H
+#define _NOISE_H
+
+#include <sys/resource.h>
+
+#include "error.h"
+
+struct program_result;
+struct record_field;
+
+// What the machine was up to during each run, from system-wide counters
+// sampled as it starts and once it's been reaped: cpu time used by
+// everything else (from /proc/stat, so only to the kernel's USER_HZ ticks,
+// and counting any other runs in flight but not measure itself), time that
+// some task was stalled on cpu, memory or io (/proc/pressure), how many
+// tasks were runnable (/proc/loadavg) and how much memory reclaim and
+// compaction went on (/proc/vmstat).  Anything unavailable is -1.
+//
+// Only the cpu time excludes the run itself.  The pressure stall times are
+// of any task, the run's own included, as are reclaim and compaction, so a
+// run that is itself short of memory or waiting on io raises them: limits
+// on those reject heavy commands for their own behaviour.
+//
+// Runs can be rejected, and run again in their place, when any of these
+// is over a limit; no more than NOISE_MAX_RETRIES in a row, after which
+// the run is recorded anyway.
+
+#define NOISE_BUFFER_SIZE 16384
+#define NOISE_MAX_LIMITS  8
+#define NOISE_MAX_RETRIES 10
+
+#define NOISE_PSI_CPU    0
+#define NOISE_PSI_MEMORY 1
+#define NOISE_PSI_IO     2
+
+struct noise_sample {
+    long busy;          // ticks of non-idle cpu time, over all cpus
+    long self;          // ns of cpu time used by measure itself
+    long psi[3];        // usec of "some" stall time, by NOISE_PSI_*
+    long pgscan;        // pages scanned for reclaim
+    long allocstall;    // direct reclaims
+    long compact_stall; // direct compactions
+};
+
+struct noise {
+    struct noise_sample before;
+    long cpu;           // ns of cpu time used by other tasks
+    long psi_cpu;       // usec with some task waiting for a cpu
+    long psi_memory;
+    long psi_io;
+    long running;       // tasks runnable as the run started
+    long pgscan;
+    long allocstall;
+    long compact_stall;
+};
+
+struct noise_limits {
+    unsigned int n;
+    const struct record_field *fields[NOISE_MAX_LIMITS];
+    long max[NOISE_MAX_LIMITS];
+    const char *args[NOISE_MAX_LIMITS];
+};
+
+#define noise_limits_init() {0}
+
+// Parses a limit such as "psi_cpu_usec:1000", one of the noise fields and
+// the most that a recorded run may have of it
+int noise_limit_parse(
+    struct noise_limits *limits,
+    const char *arg,
+    struct error_buffer *errbuf);
+
+// Samples the counters as a run starts
+void noise_begin(struct noise *n);
+
+// Samples them again once it's over, working out how much of each was
+// down to something else, its own cpu time being taken from ru
+void noise_end(struct noise *n, const struct rusage *ru);
+
+// The limit that res is over, or NULL
+const char *noise_exceeded(
+    const struct noise_limits *limits,
+    const struct program_result *res);
+
+#endif // _NOISE_H
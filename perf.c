@@ -0,0 +1,199 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perf.h"
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} perf_events[PERF_NCOUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND}};
+
+static int exclude_kernel = 0;
+
+static int perf_event_open(
+    struct perf_event_attr *attr,
+    pid_t pid, int group_fd, unsigned long flags) {
+    return syscall(SYS_perf_event_open, attr, pid, -1, group_fd, flags);
+}
+
+static void perf_attr(
+    struct perf_event_attr *attr,
+    int i,
+    int leader,
+    int onexec) {
+
+    memset(attr, 0, sizeof(struct perf_event_attr));
+    attr->size           = sizeof(struct perf_event_attr);
+    attr->type           = perf_events[i].type;
+    attr->config         = perf_events[i].config;
+    attr->read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr->inherit        = 1;
+    attr->exclude_kernel = exclude_kernel;
+    attr->exclude_hv     = 1;
+    // only the leader controls the group
+    attr->disabled       = leader && onexec;
+    attr->enable_on_exec = leader && onexec;
+}
+
+int perf_probe(struct error_buffer *errbuf) {
+    struct perf_event_attr attr;
+    for (;;) {
+        perf_attr(&attr, PERF_CYCLES, 1, 1);
+        int fd = perf_event_open(&attr, 0, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd >= 0) {
+            close(fd);
+            return 0;
+        }
+        if ((errno == EACCES || errno == EPERM) && ! exclude_kernel) {
+            exclude_kernel = 1;
+            continue;
+        }
+        snprintf(errbuf->s, errbuf->n,
+            "perf_event_open() failed, %s%s", strerror(errno),
+            errno == EACCES || errno == EPERM
+            ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+        return -1;
+    }
+}
+
+int perf_excludes_kernel(void) {
+    return exclude_kernel;
+}
+
+void perf_reset(struct perf_counters *pc) {
+    for (int i=0; i<PERF_NCOUNTERS; i++) {
+        pc->fd[i]    = -1;
+        pc->count[i] = -1;
+    }
+    pc->scale = -1;
+}
+
+static int perf_open(
+    struct perf_counters *pc,
+    pid_t pid,
+    int onexec,
+    struct error_buffer *errbuf) {
+
+    perf_reset(pc);
+
+    struct perf_event_attr attr;
+    for (int i=0; i<PERF_NCOUNTERS; i++) {
+        int leader = pc->fd[PERF_CYCLES];
+        perf_attr(&attr, i, leader < 0, onexec);
+        pc->fd[i] = perf_event_open(&attr, pid, leader, PERF_FLAG_FD_CLOEXEC);
+        if (pc->fd[i] >= 0)
+            continue;
+        if (i == PERF_CYCLES) {
+            snprintf(errbuf->s, errbuf->n,
+                "perf_event_open() failed for pid %i, %s",
+                pid, strerror(errno));
+            return -1;
+        }
+        // not supported by this hardware, or can't be scheduled with the
+        // rest of the group
+        if (errno != ENOENT && errno != EOPNOTSUPP && errno != EINVAL) {
+            snprintf(errbuf->s, errbuf->n,
+                "perf_event_open() failed for pid %i, %s",
+                pid, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int perf_attach(
+    struct perf_counters *pc,
+    pid_t pid,
+    struct error_buffer *errbuf) {
+    return perf_open(pc, pid, 1, errbuf);
+}
+
+int perf_attach_running(
+    struct perf_counters *pc,
+    pid_t pid,
+    struct error_buffer *errbuf) {
+    return perf_open(pc, pid, 0, errbuf);
+}
+
+int perf_read(
+    struct perf_counters *pc,
+    struct error_buffer *errbuf) {
+
+    for (int i=0; i<PERF_NCOUNTERS; i++) {
+        if (pc->fd[i] < 0)
+            continue;
+
+        uint64_t val[3]; // value, time enabled, time running
+        if (read(pc->fd[i], val, sizeof(val)) != sizeof(val)) {
+            snprintf(errbuf->s, errbuf->n,
+                "read of perf counter failed, %s", strerror(errno));
+            return -1;
+        }
+
+        if (val[2] == 0) {
+            // never got scheduled
+            pc->count[i] = -1;
+        } else if (val[2] < val[1]) {
+            // multiplexed, scale up to the time enabled
+            pc->count[i] = (double) val[0] * val[1] / val[2];
+        } else {
+            pc->count[i] = val[0];
+        }
+
+        // the whole group is scheduled together so the leader's scale holds
+        if (i == PERF_CYCLES)
+            pc->scale = val[1] == 0 ? 1000000
+                : (long) ((double) val[2] / val[1] * 1000000);
+    }
+
+    return 0;
+}
+
+int perf_collect(
+    struct perf_counters *pc,
+    struct error_buffer *errbuf) {
+
+    if (perf_read(pc, errbuf) < 0)
+        return -1;
+    perf_close(pc);
+    return 0;
+}
+
+void perf_close(struct perf_counters *pc) {
+    for (int i=0; i<PERF_NCOUNTERS; i++)
+        if (pc->fd[i] >= 0) {
+            close(pc->fd[i]);
+            pc->fd[i] = -1;
+        }
+}
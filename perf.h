@@ -0,0 +1,82 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PERF_H
+#define _PERF_H
+
+#include <sys/types.h>
+
+#include "error.h"
+
+// Hardware performance counters for each run, see perf_event_open(2).
+// The counters are attached to the child while it waits before execv(),
+// enabled on exec and inherited by all of its descendants; they're
+// grouped so that they're multiplexed together, and counts are scaled by
+// how long they were actually running when they had to be multiplexed.
+
+#define PERF_CYCLES           0
+#define PERF_INSTRUCTIONS     1
+#define PERF_CACHE_MISSES     2
+#define PERF_BRANCH_MISSES    3
+#define PERF_STALLED_FRONTEND 4
+#define PERF_STALLED_BACKEND  5
+#define PERF_NCOUNTERS        6
+
+struct perf_counters {
+    int fd[PERF_NCOUNTERS];
+    long count[PERF_NCOUNTERS]; // -1 if unavailable
+    long scale; // parts per million of the time the counters ran
+};
+
+// Checks whether counters can be opened at all, e.g. that
+// perf_event_paranoid allows us; if user space is all we're allowed to
+// count, subsequent counters will exclude the kernel.
+int perf_probe(struct error_buffer *errbuf);
+
+// Whether counters exclude kernel space, as determined by perf_probe()
+int perf_excludes_kernel(void);
+
+void perf_reset(struct perf_counters *pc);
+
+// Attaches counters to pid, which must not have exec'd yet; counters the
+// hardware doesn't support are just marked unavailable.
+int perf_attach(
+    struct perf_counters *pc,
+    pid_t pid,
+    struct error_buffer *errbuf);
+
+// Attaches counters, counting from now on, to pid (a thread) that's
+// already running, along with any threads or children it starts later.
+int perf_attach_running(
+    struct perf_counters *pc,
+    pid_t pid,
+    struct error_buffer *errbuf);
+
+// Reads the counters' totals so far into count
+int perf_read(
+    struct perf_counters *pc,
+    struct error_buffer *errbuf);
+
+// Reads and closes the counters once pid has been reaped
+int perf_collect(
+    struct perf_counters *pc,
+    struct error_buffer *errbuf);
+
+void perf_close(struct perf_counters *pc);
+
+#endif // _PERF_H
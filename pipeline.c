@@ -0,0 +1,181 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+
+static void *pipeline_run(void *arg) {
+    struct pipeline *pl = arg;
+    char _errbuf[PIPELINE_ERRBUF_SIZE];
+    struct error_buffer errbuf = {PIPELINE_ERRBUF_SIZE-1, _errbuf};
+
+    pthread_mutex_lock(&pl->lock);
+    for (;;) {
+        while (pl->npending == 0 && ! pl->closing)
+            pthread_cond_wait(&pl->cond, &pl->lock);
+        if (pl->npending == 0)
+            break;
+
+        struct program_result *res = pl->pending[pl->head];
+        pl->head = (pl->head + 1) % pl->size;
+        pl->npending--;
+        pl->busy = 1;
+        int failed = pl->failed;
+        pthread_mutex_unlock(&pl->lock);
+
+        // after a failure results are only freed, for the main thread to
+        // find out about it and stop
+        int r = 0;
+        if (! failed) {
+            r = program_result_keep(res, &errbuf);
+            if (r == 0) {
+                record_write(pl->schema, res);
+                record_flush(pl->schema);
+            }
+        }
+        program_result_free(res);
+
+        pthread_mutex_lock(&pl->lock);
+        if (r < 0 && ! pl->failed) {
+            pl->failed = 1;
+            strncpy(pl->err, errbuf.s, PIPELINE_ERRBUF_SIZE-1);
+        }
+        pl->done[pl->ndone++] = res;
+        pl->busy = 0;
+        pthread_cond_broadcast(&pl->cond);
+    }
+    pthread_mutex_unlock(&pl->lock);
+    return NULL;
+}
+
+int pipeline_start(
+    struct pipeline *pl,
+    struct record_schema *schema,
+    unsigned int size,
+    const cpu_set_t *cpus,
+    struct error_buffer *errbuf) {
+
+    pl->schema   = schema;
+    pl->size     = size;
+    pl->head     = 0;
+    pl->npending = 0;
+    pl->ndone    = 0;
+    pl->busy     = 0;
+    pl->closing  = 0;
+    pl->failed   = 0;
+    pl->err[PIPELINE_ERRBUF_SIZE-1] = '\0';
+
+    pl->pending = calloc(2 * size, sizeof(struct program_result *));
+    if (pl->pending == NULL) {
+        strncpy(errbuf->s, "calloc() failed", errbuf->n);
+        return -1;
+    }
+    pl->done = pl->pending + size;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    int r = cpus != NULL
+        ? pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpus) : 0;
+    if (r != 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "pthread_attr_setaffinity_np() failed, %s", strerror(r));
+        pthread_attr_destroy(&attr);
+        return -1;
+    }
+
+    pthread_mutex_init(&pl->lock, NULL);
+    pthread_cond_init(&pl->cond, NULL);
+    r = pthread_create(&pl->thread, &attr, pipeline_run, pl);
+    pthread_attr_destroy(&attr);
+    if (r != 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "pthread_create() failed, %s", strerror(r));
+        return -1;
+    }
+
+    return 0;
+}
+
+int pipeline_push(
+    struct pipeline *pl,
+    struct program_result *res,
+    struct error_buffer *errbuf) {
+
+    pthread_mutex_lock(&pl->lock);
+    if (pl->npending + pl->ndone + pl->busy >= pl->size) {
+        pthread_mutex_unlock(&pl->lock);
+        strncpy(errbuf->s, "pipeline full", errbuf->n);
+        return -1;
+    }
+    pl->pending[(pl->head + pl->npending++) % pl->size] = res;
+    pthread_cond_broadcast(&pl->cond);
+    pthread_mutex_unlock(&pl->lock);
+    return 0;
+}
+
+// Gives finished results back to the pool, with the lock held
+static void pipeline_release(struct pipeline *pl, struct pool *pool) {
+    while (pl->ndone > 0)
+        pool_release(pool, pl->done[--pl->ndone]);
+}
+
+int pipeline_reclaim(
+    struct pipeline *pl,
+    struct pool *pool,
+    struct error_buffer *errbuf) {
+
+    pthread_mutex_lock(&pl->lock);
+    for (;;) {
+        pipeline_release(pl, pool);
+        if (pl->failed || pool_can_start(pool) ||
+            (pl->npending == 0 && ! pl->busy))
+            break;
+        pthread_cond_wait(&pl->cond, &pl->lock);
+    }
+    int failed = pl->failed;
+    if (failed)
+        strncpy(errbuf->s, pl->err, errbuf->n);
+    pthread_mutex_unlock(&pl->lock);
+    return failed ? -1 : 0;
+}
+
+int pipeline_finish(
+    struct pipeline *pl,
+    struct pool *pool,
+    struct error_buffer *errbuf) {
+
+    pthread_mutex_lock(&pl->lock);
+    pl->closing = 1;
+    pthread_cond_broadcast(&pl->cond);
+    pthread_mutex_unlock(&pl->lock);
+
+    pthread_join(pl->thread, NULL);
+    pipeline_release(pl, pool);
+    free(pl->pending);
+    pl->pending = pl->done = NULL;
+
+    if (pl->failed) {
+        strncpy(errbuf->s, pl->err, errbuf->n);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "error.h"
+#include "pool.h"
+#include "record.h"
+
+// Finishes off recorded runs on a worker thread, so that the next run can
+// already be going: the worker links any in-memory outputs into place,
+// writes and flushes the run's record, and frees the result (closing its
+// files and removing its {tmpdir}), after which the main thread gives it
+// back to the pool.  The pool should hold two results per slot for this.
+
+#define PIPELINE_ERRBUF_SIZE 1024
+
+struct pipeline {
+    struct record_schema *schema;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned int size;
+    struct program_result **pending; // ring of size, from head
+    unsigned int head;
+    unsigned int npending;
+    struct program_result **done;    // finished, to be released
+    unsigned int ndone;
+    int busy;                        // the worker has a result in hand
+    int closing;
+    int failed;
+    char err[PIPELINE_ERRBUF_SIZE];
+};
+
+// Starts the worker for up to size results at once, pinned to cpus unless
+// that's NULL.
+int pipeline_start(
+    struct pipeline *pl,
+    struct record_schema *schema,
+    unsigned int size,
+    const cpu_set_t *cpus,
+    struct error_buffer *errbuf);
+
+// Hands a result, as returned by pool_wait(), to the worker.
+int pipeline_push(
+    struct pipeline *pl,
+    struct program_result *res,
+    struct error_buffer *errbuf);
+
+// Releases finished results back to the pool, waiting for the worker until
+// pool_can_start(); returns -1 if the worker has failed.
+int pipeline_reclaim(
+    struct pipeline *pl,
+    struct pool *pool,
+    struct error_buffer *errbuf);
+
+// Waits for the worker to finish everything pushed, releasing it all.
+int pipeline_finish(
+    struct pipeline *pl,
+    struct pool *pool,
+    struct error_buffer *errbuf);
+
+#endif // _PIPELINE_H
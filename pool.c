@@ -0,0 +1,370 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "sighandler.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+const struct record_field pool_fields[] = {
+    record_field("slot", RECORD_UINT, slot),
+    record_field("cpu",  RECORD_INT,  cpu)};
+
+const size_t pool_nfields =
+    sizeof(pool_fields) / sizeof(struct record_field);
+
+static int pidfd_open(pid_t pid) {
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+// Event sources, packed with the slot index into epoll_event data
+#define POOL_EV_CHILD   0
+#define POOL_EV_CAPTURE 1 // + PROGRAM_STD{OUT,ERR}
+#define POOL_EV_TIMELINE 3
+#define POOL_EV_EXEC     4
+#define POOL_EV_TIMER    5 // of the pool rather than any slot
+
+#define POOL_MAX_EVENTS 16
+
+#define pool_ev(slot, source) (((uint64_t) (slot) << 8) | (source))
+#define pool_ev_slot(data)    ((data) >> 8)
+#define pool_ev_source(data)  ((data) & 0xff)
+
+static int pool_watch(
+    struct pool *pool,
+    int fd,
+    uint64_t data,
+    struct error_buffer *errbuf) {
+
+    struct epoll_event ev;
+    ev.events   = EPOLLIN;
+    ev.data.u64 = data;
+    if (epoll_ctl(pool->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "epoll_ctl() failed, %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Unwatches fd, which must be explicitly removed from the epoll set
+// since a child that has yet to exec may still share it.
+static void pool_unwatch(struct pool *pool, int fd) {
+    epoll_ctl(pool->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int pool_slot_busy(struct pool_slot *slot) {
+    return ! slot->exited ||
+        slot->res.capture[PROGRAM_STDOUT].fd >= 0 ||
+        slot->res.capture[PROGRAM_STDERR].fd >= 0;
+}
+
+int pool_setup(
+    struct pool *pool,
+    const struct program *prog,
+    unsigned int nslots,
+    unsigned int depth,
+    const int *cpus,
+    struct error_buffer *errbuf) {
+
+    pool->prog    = prog;
+    pool->nslots  = nslots;
+    pool->depth   = depth;
+    pool->running = 0;
+
+    pool->slots = calloc(nslots * depth, sizeof(struct pool_slot));
+    if (pool->slots == NULL) {
+        strncpy(errbuf->s, "calloc() failed", errbuf->n);
+        return -1;
+    }
+
+    for (int i=0; i<nslots * depth; i++) {
+        struct pool_slot *slot = &pool->slots[i];
+        program_result_reset(&slot->res, prog);
+        slot->state = POOL_SLOT_FREE;
+        slot->cpu   = cpus != NULL ? cpus[i % nslots] : -1;
+        slot->pidfd = -1;
+    }
+
+    pool->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (pool->epfd < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "epoll_create1() failed, %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// Slot i holds results for slot i % nslots, which can start a run in any
+// of its free entries as long as none of them is running
+static struct pool_slot *pool_free_slot(const struct pool *pool) {
+    unsigned int n = pool->nslots * pool->depth;
+    for (int i=0; i<n; i++) {
+        if (pool->slots[i].state != POOL_SLOT_FREE)
+            continue;
+        int running = 0;
+        for (int j=i % pool->nslots; j<n; j+=pool->nslots)
+            if (pool->slots[j].state == POOL_SLOT_RUNNING)
+                running = 1;
+        if (! running)
+            return &pool->slots[i];
+    }
+    return NULL;
+}
+
+int pool_can_start(const struct pool *pool) {
+    return pool_free_slot(pool) != NULL;
+}
+
+struct program_result *pool_start(
+    struct pool *pool,
+    const struct program *prog,
+    unsigned long run,
+    unsigned long combo,
+    struct error_buffer *errbuf) {
+
+    struct pool_slot *slot = pool_free_slot(pool);
+    if (slot == NULL) {
+        strncpy(errbuf->s, "no free pool slot", errbuf->n);
+        return NULL;
+    }
+
+    struct program_result *res = &slot->res;
+    program_result_reset(res, prog != NULL ? prog : pool->prog);
+    res->slot  = (slot - pool->slots) % pool->nslots;
+    res->cpu   = slot->cpu;
+    res->run   = run;
+    res->combo = combo;
+
+    // running before the start so that cleanup will find any files
+    slot->state  = POOL_SLOT_RUNNING;
+    slot->exited = 0;
+    pool->running++;
+    if (program_start(res, errbuf) < 0)
+        return NULL;
+
+    slot->pidfd = pidfd_open(res->pid);
+    if (slot->pidfd < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "pidfd_open(%i) failed, %s", res->pid, strerror(errno));
+        return NULL;
+    }
+
+    if (pool_watch(pool, slot->pidfd,
+            pool_ev(slot - pool->slots, POOL_EV_CHILD), errbuf) < 0)
+        return NULL;
+
+    for (int i=0; i<2; i++)
+        if (res->capture[i].fd >= 0 &&
+            pool_watch(pool, res->capture[i].fd,
+                pool_ev(slot - pool->slots, POOL_EV_CAPTURE + i), errbuf) < 0)
+            return NULL;
+
+    if (res->timeline.fd >= 0 &&
+        pool_watch(pool, res->timeline.fd,
+            pool_ev(slot - pool->slots, POOL_EV_TIMELINE), errbuf) < 0)
+        return NULL;
+
+    if (res->execfd >= 0 &&
+        pool_watch(pool, res->execfd,
+            pool_ev(slot - pool->slots, POOL_EV_EXEC), errbuf) < 0)
+        return NULL;
+
+    return res;
+}
+
+// Arms the pool's timer to go off at deadline, or as good as now if that's
+// already passed; returns 0 if it has passed.
+static int pool_arm_timer(
+    struct pool *pool,
+    const struct timespec *deadline,
+    struct error_buffer *errbuf) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    long delay = (deadline->tv_sec - now.tv_sec) * 1000000000L +
+        deadline->tv_nsec - now.tv_nsec;
+    if (delay <= 0)
+        return 0;
+
+    if (pool->timerfd < 0) {
+        pool->timerfd = timerfd_create(CLOCK_MONOTONIC,
+            TFD_NONBLOCK | TFD_CLOEXEC);
+        if (pool->timerfd < 0) {
+            snprintf(errbuf->s, errbuf->n,
+                "timerfd_create() failed, %s", strerror(errno));
+            return -1;
+        }
+        if (pool_watch(pool, pool->timerfd,
+                pool_ev(0, POOL_EV_TIMER), errbuf) < 0)
+            return -1;
+    }
+
+    // the raw clock can't be used for timers, but over a delay this short
+    // it keeps close enough to the monotonic one
+    struct itimerspec its = {{0, 0}, {delay / 1000000000L,
+                                      delay % 1000000000L}};
+    if (timerfd_settime(pool->timerfd, 0, &its, NULL) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "timerfd_settime() failed, %s", strerror(errno));
+        return -1;
+    }
+    return 1;
+}
+
+struct program_result *pool_wait(
+    struct pool *pool,
+    struct error_buffer *errbuf) {
+    return pool_wait_until(pool, NULL, NULL, errbuf);
+}
+
+struct program_result *pool_wait_until(
+    struct pool *pool,
+    const struct timespec *deadline,
+    int *timedout,
+    struct error_buffer *errbuf) {
+
+    if (deadline != NULL) {
+        *timedout = 0;
+        int r = pool_arm_timer(pool, deadline, errbuf);
+        if (r < 0)
+            return NULL;
+        if (r == 0) {
+            *timedout = 1;
+            return NULL;
+        }
+    } else if (pool->running == 0) {
+        strncpy(errbuf->s, "no running children to wait for", errbuf->n);
+        return NULL;
+    }
+
+    for (;;) {
+        struct epoll_event evs[POOL_MAX_EVENTS];
+        int n = epoll_wait(pool->epfd, evs, POOL_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            snprintf(errbuf->s, errbuf->n,
+                "epoll_wait() failed, %s", strerror(errno));
+            return NULL;
+        }
+        if (n == 0)
+            continue;
+
+        // exec times are taken as they're handled, so those go first; the
+        // rest are only handled one at a time, any left being reported
+        // again by the next epoll_wait()
+        struct epoll_event ev = evs[0];
+        for (int i=1; i<n; i++)
+            if (pool_ev_source(evs[i].data.u64) == POOL_EV_EXEC) {
+                ev = evs[i];
+                break;
+            }
+
+        struct pool_slot *slot = &pool->slots[pool_ev_slot(ev.data.u64)];
+        struct program_result *res = &slot->res;
+        int source = pool_ev_source(ev.data.u64);
+
+        if (source == POOL_EV_TIMER) {
+            uint64_t expirations;
+            if (read(pool->timerfd, &expirations, sizeof(expirations)) > 0 &&
+                deadline != NULL) {
+                *timedout = 1;
+                return NULL;
+            }
+            continue;
+        } else if (source == POOL_EV_TIMELINE) {
+            if (program_sample(res, errbuf) < 0)
+                return NULL;
+            continue;
+        } else if (source == POOL_EV_EXEC) {
+            pool_unwatch(pool, res->execfd);
+            program_execed(res);
+            continue;
+        } else if (source == POOL_EV_CHILD) {
+            if (res->timeline.fd >= 0)
+                pool_unwatch(pool, res->timeline.fd);
+            // an exit noticed first leaves the exec time as late as this
+            if (res->execfd >= 0)
+                pool_unwatch(pool, res->execfd);
+            if (program_wait(res, errbuf) < 0)
+                return NULL;
+            pool_unwatch(pool, slot->pidfd);
+            close(slot->pidfd);
+            slot->pidfd  = -1;
+            slot->exited = 1;
+        } else {
+            struct capture *cap = &res->capture[source - POOL_EV_CAPTURE];
+            int r = capture_pump(cap, errbuf);
+            if (r < 0)
+                return NULL;
+            if (r == 0) {
+                pool_unwatch(pool, cap->fd);
+                capture_close(cap);
+            }
+        }
+
+        if (! pool_slot_busy(slot)) {
+            slot->state = POOL_SLOT_DONE;
+            pool->running--;
+            return res;
+        }
+    }
+}
+
+void pool_release(
+    struct pool *pool,
+    struct program_result *res) {
+
+    struct pool_slot *slot = (struct pool_slot *)
+        ((char *) res - offsetof(struct pool_slot, res));
+    program_result_free(res);
+    slot->state = POOL_SLOT_FREE;
+}
+
+void pool_cleanup(struct pool *pool) {
+    for (int i=0; i<pool->nslots * pool->depth; i++) {
+        struct pool_slot *slot = &pool->slots[i];
+        if (slot->state == POOL_SLOT_FREE)
+            continue;
+        if (slot->res.stdout != NULL)
+            unlink(slot->res.stdout);
+        if (slot->res.stderr != NULL)
+            unlink(slot->res.stderr);
+        if (slot->res.timeline.path != NULL)
+            unlink(slot->res.timeline.path);
+        if (slot->res.pid != 0)
+            polite_kill(slot->res.pid);
+        program_result_rmtmpdir(&slot->res);
+        cgroup_close(&slot->res.cgroup);
+    }
+}
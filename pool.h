@@ -0,0 +1,107 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include "program.h"
+#include "record.h"
+
+// A pool of slots each running at most one child at a time; children are
+// reaped as they complete by waiting on their pidfds with epoll(7), which
+// also services any output they have being captured.  Each slot can hold
+// more than one result, so that one run's result may still be being
+// finished off (see pipeline.h) while the slot already runs the next.
+
+#define POOL_SLOT_FREE    0
+#define POOL_SLOT_RUNNING 1
+#define POOL_SLOT_DONE    2
+
+struct pool_slot {
+    struct program_result res; // res.slot being the slot it's held for
+    int state;
+    int cpu;
+    int pidfd;
+    int exited;
+};
+
+struct pool {
+    const struct program *prog;
+    unsigned int nslots;
+    unsigned int depth; // results held per slot
+    unsigned int running;
+    struct pool_slot *slots;
+    int epfd;
+    int timerfd; // for pool_wait_until(), made when first needed
+};
+
+#define pool_init() {NULL, 0, 1, 0, NULL, -1, -1}
+
+// The slot and cpu that each run used
+extern const struct record_field pool_fields[];
+extern const size_t pool_nfields;
+
+// Sets up nslots slots for running prog, each holding up to depth results;
+// if cpus is non-NULL each slot's children are pinned to the corresponding
+// cpu.
+int pool_setup(
+    struct pool *pool,
+    const struct program *prog,
+    unsigned int nslots,
+    unsigned int depth,
+    const int *cpus,
+    struct error_buffer *errbuf);
+
+// Starts a child of prog (or the pool's program if NULL) in a free slot,
+// as the given run with the given combination of parameter values (see
+// template.h); returns NULL on error or if no slot is free.
+struct program_result *pool_start(
+    struct pool *pool,
+    const struct program *prog,
+    unsigned long run,
+    unsigned long combo,
+    struct error_buffer *errbuf);
+
+// Whether pool_start() would find a slot, which may not be so even with
+// fewer than nslots running while results are still held.
+int pool_can_start(const struct pool *pool);
+
+// Blocks until a running child exits and returns its (reaped) result; the
+// result remains owned by the pool until passed to pool_release().
+struct program_result *pool_wait(
+    struct pool *pool,
+    struct error_buffer *errbuf);
+
+// Like pool_wait(), but if deadline (by CLOCK_MONOTONIC_RAW) passes first
+// returns NULL with *timedout set instead; there need not be any running
+// children.
+struct program_result *pool_wait_until(
+    struct pool *pool,
+    const struct timespec *deadline,
+    int *timedout,
+    struct error_buffer *errbuf);
+
+void pool_release(
+    struct pool *pool,
+    struct program_result *res);
+
+// Kills any running children and unlinks the output files of any
+// unreleased result.
+void pool_cleanup(struct pool *pool);
+
+#endif // _POOL_H
@@ -0,0 +1,89 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "procstat.h"
+
+ssize_t procstat_file(char *buf, size_t size, const char *fmt, ...) {
+    char path[PATH_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(path, sizeof(path), fmt, ap);
+    va_end(ap);
+    if (len < 0 || (size_t) len >= sizeof(path))
+        return -1;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t got = read(fd, buf, size - 1);
+    close(fd);
+    if (got < 0)
+        return -1;
+    buf[got] = '\0';
+    return got;
+}
+
+long procstat_key(const char *buf, const char *key) {
+    size_t len = strlen(key);
+    for (const char *p = buf; p != NULL && *p != '\0'; ) {
+        if (strncmp(p, key, len) == 0 && p[len] == ':')
+            return strtol(p + len + 1, NULL, 10);
+        p = strchr(p, '\n');
+        if (p != NULL)
+            p++;
+    }
+    return -1;
+}
+
+void procstat_read(struct procstat *ps, pid_t pid) {
+    char dir[32];
+    snprintf(dir, sizeof(dir), "/proc/%i", pid);
+    procstat_read_dir(ps, dir);
+}
+
+void procstat_read_dir(struct procstat *ps, const char *dir) {
+    char buf[PROCSTAT_BUFFER_SIZE];
+
+    ps->sched_runtime = ps->sched_delay = ps->sched_slices = -1;
+    if (procstat_file(buf, sizeof(buf), "%s/schedstat", dir) >= 0)
+        sscanf(buf, "%ld %ld %ld",
+            &ps->sched_runtime, &ps->sched_delay, &ps->sched_slices);
+
+    ps->io_read_bytes = ps->io_write_bytes = -1;
+    ps->io_syscr = ps->io_syscw = -1;
+    if (procstat_file(buf, sizeof(buf), "%s/io", dir) >= 0) {
+        ps->io_read_bytes  = procstat_key(buf, "read_bytes");
+        ps->io_write_bytes = procstat_key(buf, "write_bytes");
+        ps->io_syscr       = procstat_key(buf, "syscr");
+        ps->io_syscw       = procstat_key(buf, "syscw");
+    }
+
+    ps->nvcsw = ps->nivcsw = -1;
+    if (procstat_file(buf, sizeof(buf), "%s/status", dir) >= 0) {
+        ps->nvcsw  = procstat_key(buf, "voluntary_ctxt_switches");
+        ps->nivcsw = procstat_key(buf, "nonvoluntary_ctxt_switches");
+    }
+}
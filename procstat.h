@@ -0,0 +1,60 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PROCSTAT_H
+#define _PROCSTAT_H
+
+#include <sys/types.h>
+
+// What /proc still has to say about a child once it has exited but before
+// it's reaped, while it's a zombie: how long it sat runnable waiting for a
+// cpu (schedstat), the I/O it really did (io) and how its own context
+// switches went (status).  schedstat and status are of the command's main
+// thread; io, like rusage, also counts threads and children that it has
+// waited for.  Anything that can't be read, say for want of schedstats in
+// the kernel, is left -1.
+
+#define PROCSTAT_BUFFER_SIZE 8192
+
+struct procstat {
+    long sched_runtime;   // ns on a cpu
+    long sched_delay;     // ns runnable but waiting for a cpu
+    long sched_slices;    // times it was run on a cpu
+    long io_read_bytes;   // from storage
+    long io_write_bytes;  // to storage
+    long io_syscr;        // read(2) and the like
+    long io_syscw;        // write(2) and the like
+    long nvcsw;           // voluntary context switches, of the main thread
+    long nivcsw;          // and involuntary ones
+};
+
+// Reads pid's schedstat, io and status into ps; pid must not be reaped yet
+void procstat_read(struct procstat *ps, pid_t pid);
+
+// The same from dir, /proc/<pid> or /proc/<pid>/task/<tid>
+void procstat_read_dir(struct procstat *ps, const char *dir);
+
+// Reads the start of the file at the path that fmt formats into buf, NUL
+// terminated; returns how many bytes it read, or -1 if it can't
+ssize_t procstat_file(char *buf, size_t size, const char *fmt, ...)
+    __attribute__ ((format (printf, 3, 4)));
+
+// The value of a "key:  value" line in buf, or -1 if there isn't one
+long procstat_key(const char *buf, const char *key);
+
+#endif // _PROCSTAT_H
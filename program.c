@@ -18,6 +18,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <ftw.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -84,7 +85,7 @@ int program_set_path(
         bufp = memcpy(bufp, path, pathlen) + pathlen;
         *bufp = '\0';
         if (access(buf, X_OK) == 0) {
-            pathlen = bufp - buf;
+            pathlen = bufp - buf + 1;
             char *path = malloc(pathlen);
             if (path == NULL) {
                 strncpy(errbuf->s, "malloc() failed", errbuf->n);
@@ -123,91 +124,169 @@ int program_set_argv(
     return 0;
 }
 
+void program_result_reset(
+    struct program_result *res,
+    const struct program *prog) {
+    memset(res, 0, sizeof(struct program_result));
+    res->prog   = prog;
+    res->commfd = -1;
+    res->cpu    = -1;
+    res->execfd = -1;
+    capture_reset(&res->capture[PROGRAM_STDOUT]);
+    capture_reset(&res->capture[PROGRAM_STDERR]);
+    perf_reset(&res->perf);
+    cgroup_reset(&res->cgroup);
+    timeline_reset(&res->timeline);
+}
+
 void program_result_free(struct program_result *res) {
-    if (res->stdout != NULL &&
-        res->stdout != res->prog->stdout)
-        free((char *) res->stdout);
+    if (res->execfd >= 0) {
+        close(res->execfd);
+        res->execfd = -1;
+    }
+    perf_close(&res->perf);
+    cgroup_close(&res->cgroup);
+    timeline_free(&res->timeline);
+    capture_close(&res->capture[PROGRAM_STDOUT]);
+    capture_close(&res->capture[PROGRAM_STDERR]);
+    capture_discard(&res->capture[PROGRAM_STDOUT]);
+    capture_discard(&res->capture[PROGRAM_STDERR]);
+    program_result_rmtmpdir(res);
     res->stdout = NULL;
-
-    if (res->stderr != NULL &&
-        res->stderr != res->prog->stderr)
-        free((char *) res->stderr);
     res->stderr = NULL;
 }
 
-int read_from_child(
-    int commfd,
+static int rmtmpdir_entry(
+    const char *path,
+    const struct stat *s,
+    int type,
+    struct FTW *ftw) {
+    remove(path);
+    return 0;
+}
+
+void program_result_rmtmpdir(struct program_result *res) {
+    if (res->tmpdir[0] == '\0')
+        return;
+    nftw(res->tmpdir, rmtmpdir_entry, 16, FTW_DEPTH | FTW_PHYS);
+    res->tmpdir[0] = '\0';
+}
+
+int program_result_keep(
     struct program_result *res,
     struct error_buffer *errbuf) {
+    for (int i=0; i<2; i++)
+        if (capture_materialize(&res->capture[i], errbuf) < 0)
+            return -1;
+    return 0;
+}
 
-    struct child_comm comm = {0, 0, NULL};
-    while (child_comm_read(commfd, &comm) == 0) {
-        if (comm.id == CHILD_COMM_ID_MESS) {
-            *((char *) comm.data + comm.len - 1) = '\0';
-            strncpy(errbuf->s, "child failed: ", errbuf->n);
-            size_t n = errbuf->n - 14;
-            if (comm.len < n) n = comm.len;
-            strncpy(errbuf->s + 14, comm.data, n);
-            free((void *) comm.data);
+void program_result_discard(struct program_result *res) {
+    const char *paths[] = {res->stdout, res->stderr};
+    for (int i=0; i<2; i++) {
+        const struct capture_spec *spec = &res->prog->capture[i];
+        if (paths[i] != NULL && spec->store == NULL &&
+            spec->mode != CAPTURE_MODE_COUNT &&
+            spec->mode != CAPTURE_MODE_HASH)
+            unlink(paths[i]);
+    }
+    if (res->timeline.path != NULL)
+        unlink(res->timeline.path);
+}
+
+// Room for everything a child sends, see child_run()
+#define PROGRAM_COMM_ARENA_SIZE \
+    (CHILD_COMM_BATCH_SIZE + CHILD_COMM_HDRLEN + CHILD_COMM_MESS_MAX)
+
+static int handle_child_comm(
+    const struct child_comm *comm,
+    struct program_result *res,
+    struct error_buffer *errbuf) {
+
+    if (comm->id == CHILD_COMM_ID_MESS) {
+        strncpy(errbuf->s, "child failed: ", errbuf->n);
+        size_t n = errbuf->n - 14;
+        if (comm->len < n) n = comm->len;
+        strncpy(errbuf->s + 14, comm->data, n);
+        errbuf->s[errbuf->n] = '\0';
+        return -1;
+    } else if (comm->id == CHILD_COMM_ID_FILEPATH) {
+        const char *name = (char *) comm->data;
+        const char *path = (char *) memchr(name, '\0', comm->len);
+        if (path == NULL || comm->len - (++path - name) > PATH_MAX ||
+            ((char *) comm->data)[comm->len - 1] != '\0') {
+            strncpy(errbuf->s, "malformed filepath child message",
+                errbuf->n);
             return -1;
-        } else if (comm.id == CHILD_COMM_ID_FILEPATH) {
-            const char *name = (char *) comm.data;
-            const char *path = (char *) memchr(name, '\0', comm.len);
-            if (path == NULL) {
-                strncpy(errbuf->s,
-                    "no null byte in filepath child message",
-                    errbuf->n);
-                free((void *) comm.data);
-                return -1;
-            }
-            path++;
-
-            const char **dst = NULL;
-            if (strcmp(name, "stdout") == 0)
-                dst = &res->stdout;
-            else if (strcmp(name, "stderr") == 0)
-                dst = &res->stderr;
-            else {
-                snprintf(errbuf->s, errbuf->n,
-                    "invalid filepath name \"%s\"", name);
-                free((void *) comm.data);
-                return -1;
-            }
-            path = strdup(path);
-            if (path == NULL) {
-                strncpy(errbuf->s, "strdup() failed", errbuf->n);
-                free((void *) comm.data);
-                return -1;
-            }
-            *dst = path;
-        } else if (comm.id == CHILD_COMM_ID_STARTTIME) {
-            if (comm.len != sizeof(struct timespec)) {
-                snprintf(errbuf->s, errbuf->n,
-                    "expected %i bytes for start time, got %i",
-                    sizeof(struct timespec), comm.len);
-                free((void *) comm.data);
-                return -1;
-            }
-            memcpy(&res->start, comm.data, sizeof(struct timespec));
-        } else {
+        }
+
+        int i;
+        if (strcmp(name, "stdout") == 0)
+            i = PROGRAM_STDOUT;
+        else if (strcmp(name, "stderr") == 0)
+            i = PROGRAM_STDERR;
+        else {
+            snprintf(errbuf->s, errbuf->n,
+                "invalid filepath name \"%s\"", name);
+            return -1;
+        }
+        strcpy(res->paths[i], path);
+        *(i == PROGRAM_STDOUT ? &res->stdout : &res->stderr) = res->paths[i];
+    } else if (comm->id == CHILD_COMM_ID_STARTTIME ||
+               comm->id == CHILD_COMM_ID_ENTERTIME) {
+        if (comm->len != sizeof(struct timespec)) {
             snprintf(errbuf->s, errbuf->n,
-                "received unknown message id %02x from child", comm.id);
-            free((void *) comm.data);
+                "expected %i bytes for %s time, got %i",
+                sizeof(struct timespec),
+                comm->id == CHILD_COMM_ID_STARTTIME ? "start" : "enter",
+                comm->len);
             return -1;
         }
-        free((void *) comm.data);
-        comm.id   = 0;
-        comm.len  = 0;
-        comm.data = NULL;
+        memcpy(comm->id == CHILD_COMM_ID_STARTTIME
+            ? &res->start : &res->phases.entered,
+            comm->data, sizeof(struct timespec));
+    } else {
+        snprintf(errbuf->s, errbuf->n,
+            "received unknown message id %02x from child", comm->id);
+        return -1;
     }
+    return 0;
+}
 
-    if (close(commfd) < -1) {
+int read_from_child(
+    int commfd,
+    struct program_result *res,
+    struct error_buffer *errbuf) {
+
+    // the child's messages are all read at once, and handled in place
+    unsigned char arena[PROGRAM_COMM_ARENA_SIZE];
+    ssize_t len = child_comm_read_all(commfd, arena, sizeof(arena));
+    int r = 0;
+    if (len < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to read from child, %s", strerror(errno));
+        r = -1;
+    }
+
+    for (ssize_t off = 0; r == 0 && off < len; ) {
+        struct child_comm comm;
+        ssize_t n = child_comm_parse(arena + off, len - off, &comm);
+        if (n < 0) {
+            strncpy(errbuf->s, "truncated child message", errbuf->n);
+            r = -1;
+        } else {
+            r = handle_child_comm(&comm, res, errbuf);
+            off += n;
+        }
+    }
+
+    if (close(commfd) < 0 && r == 0) {
         snprintf(errbuf->s, errbuf->n,
             "failed to close child read pipe, %s", strerror(errno));
-        return -1;
+        r = -1;
     }
 
-    return 0;
+    return r;
 }
 
 int handle_child(
@@ -215,9 +294,22 @@ int handle_child(
     struct program_result *res,
     struct error_buffer *errbuf) {
 
-    // TODO: try using a SIGCHLD handler rather than blocking wait
-    //       * pause(3P)
-    //       * sigaction(3P)
+    if (res->prog->phases)
+        clock_gettime(CLOCK_MONOTONIC_RAW, &res->phases.noticed);
+
+    // for procstat the child is first only waited for, left a zombie so
+    // that its /proc entry is still there to read, with its end time taken
+    // then rather than after reading it
+    if (res->prog->procstat) {
+        siginfo_t info;
+        if (waitid(P_PID, res->pid, &info, WEXITED | WNOWAIT) < 0) {
+            snprintf(errbuf->s, errbuf->n,
+                "waitid failed, %s", strerror(errno));
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &res->end);
+        procstat_read(&res->procstat, res->pid);
+    }
 
     pid_t pid = wait4(res->pid, &res->status, 0, &res->rusage);
     if (pid < 0) {
@@ -227,7 +319,8 @@ int handle_child(
     }
     res->pid = 0;
 
-    if (clock_gettime(CLOCK_MONOTONIC_RAW, &res->end) != 0) {
+    if (! res->prog->procstat &&
+        clock_gettime(CLOCK_MONOTONIC_RAW, &res->end) != 0) {
         snprintf(errbuf->s, errbuf->n,
             "clock_gettime(CLOCK_MONOTONIC_RAW) failed, %s",
             strerror(errno));
@@ -259,18 +352,31 @@ int handle_child(
     return 0;
 }
 
-struct program_result *program_run(
-    const struct program *prog,
+int program_start(
     struct program_result *res,
     struct error_buffer *errbuf) {
 
-    memset(res, 0, sizeof(struct program_result));
-    res->prog = prog;
+    const char **paths[] = {&res->stdout, &res->stderr};
+    const char *templates[] = {res->prog->stdout, res->prog->stderr};
+    for (int i=0; i<2; i++)
+        if (capture_active(&res->prog->capture[i]) &&
+            capture_open(&res->capture[i], &res->prog->capture[i],
+                templates[i], paths[i], res->paths[i], errbuf) < 0)
+            return -1;
 
-    if (lseek(prog->stdinfd, 0, SEEK_SET) < 0) {
-        snprintf(errbuf->s, errbuf->n,
-            "seek failed on child stdinfd, %s", strerror(errno));
-        return NULL;
+    if (res->prog->params != NULL)
+        template_combo(res->prog->params, res->combo, res->params);
+
+    if (res->prog->usestmpdir) {
+        const char *tmp = getenv("TMPDIR");
+        snprintf(res->tmpdir, PATH_MAX, "%s/measure-XXXXXX",
+            tmp != NULL && *tmp != '\0' ? tmp : "/tmp");
+        if (mkdtemp(res->tmpdir) == NULL) {
+            snprintf(errbuf->s, errbuf->n, "mkdtemp() failed for %s, %s",
+                res->tmpdir, strerror(errno));
+            res->tmpdir[0] = '\0';
+            return -1;
+        }
     }
 
     int commpipe[2];
@@ -278,30 +384,200 @@ struct program_result *program_run(
     if (pipe(commpipe) < 0) {
         snprintf(errbuf->s, errbuf->n,
             "pipe() failed, %s", strerror(errno));
-        return NULL;
+        return -1;
     }
     fcntl(commpipe[0], F_SETFD, FD_CLOEXEC);
     fcntl(commpipe[1], F_SETFD, FD_CLOEXEC);
 
+    // The child waits on gopipe before its execv() while we do any setup
+    // that needs its pid, e.g. attaching perf counters
+    int gopipe[2] = {-1, -1};
+    if ((res->prog->perf || res->prog->cgroup) && pipe2(gopipe, O_CLOEXEC) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "pipe() failed, %s", strerror(errno));
+        close(commpipe[0]);
+        close(commpipe[1]);
+        return -1;
+    }
+
+    // Nothing is written to the exec pipe, the child's execv() closing its
+    // end is all that's watched for
+    int execpipe[2] = {-1, -1};
+    if (res->prog->exectime && pipe2(execpipe, O_CLOEXEC) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "pipe() failed, %s", strerror(errno));
+        close(commpipe[0]);
+        close(commpipe[1]);
+        if (gopipe[0] >= 0) {
+            close(gopipe[0]);
+            close(gopipe[1]);
+        }
+        return -1;
+    }
+
+    if (res->prog->phases || res->prog->exectime)
+        clock_gettime(CLOCK_MONOTONIC_RAW, &res->phases.forked);
+
     switch (res->pid = fork()) {
     case -1:
         snprintf(errbuf->s, errbuf->n,
             "fork() failed, %s", strerror(errno));
-        return NULL;
+        close(commpipe[0]);
+        close(commpipe[1]);
+        if (gopipe[0] >= 0) {
+            close(gopipe[0]);
+            close(gopipe[1]);
+        }
+        if (execpipe[0] >= 0) {
+            close(execpipe[0]);
+            close(execpipe[1]);
+        }
+        return -1;
     case 0:
-        child_run(res, commpipe[1]);
+        if (gopipe[0] >= 0)
+            close(gopipe[1]);
+        if (execpipe[0] >= 0)
+            close(execpipe[0]);
+        child_run(res, commpipe[1], gopipe[0]);
         // shouldn't happen, child_run execv()s or exit()s
-        exit(0xfe);
+        _exit(0xfe);
     default:
+        capture_forked(&res->capture[PROGRAM_STDOUT]);
+        capture_forked(&res->capture[PROGRAM_STDERR]);
+        if (execpipe[0] >= 0) {
+            // closed before any other child is forked, so that only this
+            // one holds it open
+            close(execpipe[1]);
+            res->execfd = execpipe[0];
+        }
+        res->commfd = commpipe[0];
         if (close(commpipe[1]) < -1) {
             snprintf(errbuf->s, errbuf->n,
                 "failed to close child write pipe, %s", strerror(errno));
-            return NULL;
+            return -1;
+        }
+
+        if (res->prog->timeline != NULL &&
+            timeline_open(&res->timeline, res->prog->timeline,
+                res->prog->interval, res->pid, errbuf) < 0) {
+            if (gopipe[0] >= 0) {
+                close(gopipe[0]);
+                close(gopipe[1]);
+            }
+            return -1;
+        }
+
+        if (gopipe[0] >= 0) {
+            close(gopipe[0]);
+            int r = 0;
+            if (res->prog->cgroup)
+                r = cgroup_enter(&res->cgroup, res->pid, errbuf);
+            if (r == 0 && res->prog->perf)
+                r = perf_attach(&res->perf, res->pid, errbuf);
+            // closing without a write tells the child to give up
+            if (r == 0 && write(gopipe[1], "", 1) != 1) {
+                snprintf(errbuf->s, errbuf->n,
+                    "write to child go pipe failed, %s", strerror(errno));
+                r = -1;
+            }
+            close(gopipe[1]);
+            if (r < 0)
+                return -1;
         }
 
-        if (handle_child(commpipe[0], res, errbuf) < 0)
-            return NULL;
-        else
-            return res;
+        return 0;
     }
 }
+
+// a - b in ns
+static long timespec_diff(
+    const struct timespec *a,
+    const struct timespec *b) {
+    return (a->tv_sec - b->tv_sec) * 1000000000L + a->tv_nsec - b->tv_nsec;
+}
+
+int program_wait(
+    struct program_result *res,
+    struct error_buffer *errbuf) {
+
+    int commfd = res->commfd;
+    res->commfd = -1;
+    if (handle_child(commfd, res, errbuf) < 0)
+        return -1;
+
+    if (res->prog->perf && perf_collect(&res->perf, errbuf) < 0)
+        return -1;
+
+    if (res->prog->cgroup && cgroup_collect(&res->cgroup, errbuf) < 0)
+        return -1;
+
+    if (res->prog->timeline != NULL &&
+        timeline_close(&res->timeline, errbuf) < 0)
+        return -1;
+
+    res->read_bytes = res->rusage.ru_inblock * 512L;
+
+    // captured streams are counted as they're pumped, the sizes of files
+    // written directly by the child are taken now
+    const char *paths[] = {res->stdout, res->stderr};
+    for (int i=0; i<2; i++) {
+        struct stat s;
+        if (! capture_active(&res->prog->capture[i]) &&
+            paths[i] != NULL && stat(paths[i], &s) == 0)
+            res->capture[i].bytes = s.st_size;
+    }
+
+    if (res->prog->exectime) {
+        if (res->execfd >= 0)
+            program_execed(res);
+        res->exec_to_exit = timespec_diff(&res->end, &res->exec);
+        res->fork_to_exit = timespec_diff(&res->end, &res->phases.forked);
+    }
+
+    if (res->prog->phases) {
+        struct program_phases *ph = &res->phases;
+        struct timespec collected;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &collected);
+        ph->fork    = timespec_diff(&ph->entered, &ph->forked);
+        ph->setup   = timespec_diff(&res->start, &ph->entered);
+        ph->reap    = timespec_diff(&res->end, &ph->noticed);
+        ph->collect = timespec_diff(&collected, &res->end);
+    }
+
+    return 0;
+}
+
+void program_execed(struct program_result *res) {
+    clock_gettime(CLOCK_MONOTONIC_RAW, &res->exec);
+    close(res->execfd);
+    res->execfd = -1;
+}
+
+int program_sample(
+    struct program_result *res,
+    struct error_buffer *errbuf) {
+
+    pid_t pids[TIMELINE_MAX_PROCS];
+    int n;
+    if (res->cgroup.name[0] != '\0')
+        n = cgroup_pids(&res->cgroup, pids, TIMELINE_MAX_PROCS);
+    else
+        n = timeline_tree(res->pid, pids, TIMELINE_MAX_PROCS);
+    return timeline_sample(&res->timeline, pids, n, errbuf);
+}
+
+struct program_result *program_run(
+    const struct program *prog,
+    struct program_result *res,
+    struct error_buffer *errbuf) {
+
+    program_result_reset(res, prog);
+
+    if (program_start(res, errbuf) < 0)
+        return NULL;
+
+    if (program_wait(res, errbuf) < 0)
+        return NULL;
+
+    return res;
+}
@@ -19,10 +19,23 @@
 #ifndef _PROGRAM_H
 #define _PROGRAM_H
 
+#include <limits.h>
 #include <sys/resource.h>
 #include <time.h>
 
+#include "capture.h"
+#include "cgroup.h"
 #include "error.h"
+#include "execenv.h"
+#include "noise.h"
+#include "perf.h"
+#include "procstat.h"
+#include "template.h"
+#include "timeline.h"
+
+// Indices of the captured streams
+#define PROGRAM_STDOUT 0
+#define PROGRAM_STDERR 1
 
 struct program {
     const char *path;
@@ -31,25 +44,81 @@ struct program {
     const char *stdout;
     const char *stderr;
     int stdinfd;
+    struct capture_spec capture[2];
+    int perf;
+    int cgroup;
+    const char *timeline; // side file template, NULL if not sampling
+    long interval;        // between timeline samples, in ns
+    int phases;           // time measure's own phases around each run
+    int exectime;         // time when each run's execv() succeeded
+    int procstat;         // read /proc about each run before reaping it
+    const struct template_params *params; // see template.h
+    int templated;        // whether argv has placeholders to expand
+    int usestmpdir;       // whether any of them is {tmpdir}
+    struct exec_env env;
+};
+
+// How long measure itself took around a run, in ns: from fork() to the
+// child running, the child setting up until its start time, noticing the
+// child's exit until its end time, and collecting everything after that.
+struct program_phases {
+    struct timespec forked;  // in the parent, just before fork()
+    struct timespec entered; // in the child, just after fork()
+    struct timespec noticed; // in the parent, before reaping the child
+    long fork;
+    long setup;
+    long reap;
+    long collect;
 };
 
 struct program_result {
     const struct program *prog;
     pid_t pid;
+    int commfd;
+    unsigned int slot;
+    int cpu;
+    unsigned int variant; // of the programs being compared
+    unsigned long run;    // {run} in argv
+    unsigned long combo;  // of parameter values, see template.h
+    const char *params[TEMPLATE_MAX_PARAMS]; // the combination's values
+    char tmpdir[PATH_MAX]; // {tmpdir} in argv, if used
+    long read_bytes;      // from disk, ru_inblock being in 512 byte blocks
     struct timespec start;
     struct timespec end;
     int status;
     struct rusage rusage;
     const char *stdout;
     const char *stderr;
+    char paths[2][PATH_MAX]; // where stdout and stderr point, if not NULL
+    struct capture capture[2];
+    struct perf_counters perf;
+    struct cgroup_run cgroup;
+    struct timeline timeline;
+    struct procstat procstat;
+    struct noise noise;
+    struct program_phases phases;
+    // with exectime, the child's execv() closes its end of a close-on-exec
+    // pipe, the parent noticing the end of file as the exec time
+    int execfd;
+    struct timespec exec;
+    long exec_to_exit;    // in ns, from the exec time to the end time
+    long fork_to_exit;    // in ns, from just before fork() to the end time
+    // with a --rate, when the run was meant to start (see rate.h)
+    struct timespec intended;
+    long start_lag;       // in ns, from the intended time to the start time
+    long latency;         // in ns, from the intended time to the end time
 };
 
-#define program_init() {NULL, NULL, NULL, NULL, NULL, 0}
+#define program_init() {NULL, NULL, NULL, NULL, NULL, 0, \
+    {capture_spec_init(), capture_spec_init()}, 0, 0, NULL, 0, 0, 0, 0, NULL, \
+    0, 0, execenv_init()}
 
-#define program_result_init() {\
-    NULL, 0, {0, 0}, {0, 0}, 0, \
-    {{0, 0}, {0, 0}, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, \
-    NULL, NULL}
+#define program_result_init() {.commfd = -1, .cpu = -1, .execfd = -1, \
+    .capture = {{.fd = -1, .childfd = -1, .outfd = -1}, \
+                {.fd = -1, .childfd = -1, .outfd = -1}}, \
+    .perf = {{-1, -1, -1, -1, -1, -1}, {-1, -1, -1, -1, -1, -1}, -1}, \
+    .cgroup = {"", -1, -1, -1, -1, -1, -1, -1, -1, -1}, \
+    .timeline = {.fd = -1}}
 
 int program_set_path(
     struct program *prog,
@@ -62,8 +131,48 @@ int program_set_argv(
     const char *argv[],
     struct error_buffer *errbuf);
 
+void program_result_reset(
+    struct program_result *res,
+    const struct program *prog);
+
 void program_result_free(struct program_result *res);
 
+// Removes the run's {tmpdir} and everything in it
+void program_result_rmtmpdir(struct program_result *res);
+
+// Links any outputs kept in memory into the filesystem, for runs that
+// will be recorded
+int program_result_keep(
+    struct program_result *res,
+    struct error_buffer *errbuf);
+
+// Removes the files that a result's outputs were written to, for runs
+// that won't be recorded; outputs in a store are left alone, since they
+// may be shared.
+void program_result_discard(struct program_result *res);
+
+// Forks and starts the child for res, which should have been reset with
+// program_result_reset(); on success res->pid and res->commfd are set and
+// program_wait() must be called to collect the result.
+int program_start(
+    struct program_result *res,
+    struct error_buffer *errbuf);
+
+// Reaps the child started by program_start(), blocking until it exits.
+int program_wait(
+    struct program_result *res,
+    struct error_buffer *errbuf);
+
+// Notes the exec time of the child, once res->execfd is readable (at end
+// of file) or the child has exited.
+void program_execed(struct program_result *res);
+
+// Takes a timeline sample of the child, and its descendants (those in its
+// cgroup if it has one), whenever res->timeline.fd is readable.
+int program_sample(
+    struct program_result *res,
+    struct error_buffer *errbuf);
+
 struct program_result *program_run(
     const struct program *prog,
     struct program_result *res,
@@ -0,0 +1,83 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rate.h"
+
+int rate_parse(
+    struct rate *rate,
+    const char *arg,
+    struct error_buffer *errbuf) {
+
+    char *end;
+    double r = strtod(arg, &end);
+    double per = 1e9;
+    if (strcmp(end, "/ms") == 0)
+        per = 1e6;
+    else if (strcmp(end, "/m") == 0)
+        per = 60e9;
+    else if (*end != '\0' && strcmp(end, "/s") != 0)
+        end = (char *) arg;
+    if (end == arg || ! (r > 0) || per / r < 1) {
+        snprintf(errbuf->s, errbuf->n,
+            "invalid rate \"%s\", expected e.g. 100/s", arg);
+        return -1;
+    }
+    rate->interval = per / r;
+    return 0;
+}
+
+void rate_setup(struct rate *rate) {
+    clock_gettime(CLOCK_MONOTONIC_RAW, &rate->next);
+}
+
+int rate_due(const struct rate *rate, const struct timespec *now) {
+    return now->tv_sec > rate->next.tv_sec ||
+        (now->tv_sec == rate->next.tv_sec &&
+         now->tv_nsec >= rate->next.tv_nsec);
+}
+
+void rate_start(struct rate *rate, struct program_result *res) {
+    res->intended = rate->next;
+
+    // exponentially distributed gaps, from a uniform draw in (0, 1]
+    long gap = rate->interval;
+    if (rate->poisson)
+        gap = -log((rand_r(&rate->seed) + 1.0) / (RAND_MAX + 1.0)) *
+            rate->interval;
+    gap += rate->next.tv_nsec;
+    rate->next.tv_sec  += gap / 1000000000L;
+    rate->next.tv_nsec  = gap % 1000000000L;
+}
+
+// a - b in ns
+static long timespec_diff(
+    const struct timespec *a,
+    const struct timespec *b) {
+    return (a->tv_sec - b->tv_sec) * 1000000000L + a->tv_nsec - b->tv_nsec;
+}
+
+void rate_finish(struct rate *rate, struct program_result *res) {
+    res->start_lag = timespec_diff(&res->start, &res->intended);
+    res->latency   = timespec_diff(&res->end, &res->intended);
+    stats_add_value(&rate->latency, res->latency);
+}
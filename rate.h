@@ -0,0 +1,71 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RATE_H
+#define _RATE_H
+
+#include <time.h>
+
+#include "error.h"
+#include "program.h"
+#include "stats.h"
+
+// Open-loop sampling: runs are started on a schedule of their own, at a
+// fixed rate or as a Poisson process of that rate, rather than each as
+// the last one exits.  A run that can't start on time, all slots being
+// busy, starts as soon as one is free while the schedule goes on without
+// it; timing each run from when it was meant to start (its latency)
+// rather than when it did keeps that delay in the results instead of
+// quietly leaving it out (coordinated omission).  Latencies go into a
+// stats histogram, so their percentiles take constant space however many
+// runs there are, and are within the same bound as stats.c's.
+
+// Slots used for -j if not given, to keep up with runs that overlap
+#define RATE_DEFAULT_SLOTS 16
+
+struct rate {
+    long interval;          // mean ns between intended starts
+    int poisson;
+    unsigned int seed;
+    struct timespec next;   // intended start of the next run
+    struct stats_metric latency;
+};
+
+#define rate_init() {0, 0, 0, {0, 0}, {"latency"}}
+
+// Parses a rate of runs such as "100/s", "5/ms" or "30/m"; a bare number
+// is per second.
+int rate_parse(
+    struct rate *rate,
+    const char *arg,
+    struct error_buffer *errbuf);
+
+// Starts the schedule now
+void rate_setup(struct rate *rate);
+
+// Whether the next run is due, as of now
+int rate_due(const struct rate *rate, const struct timespec *now);
+
+// Gives res the next intended start, and schedules the one after
+void rate_start(struct rate *rate, struct program_result *res);
+
+// Works out res's start_lag and latency once it has finished, adding the
+// latency to rate->latency
+void rate_finish(struct rate *rate, struct program_result *res);
+
+#endif // _RATE_H
@@ -0,0 +1,380 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "record.h"
+#include "sha256.h"
+
+const struct record_field program_fields[] = {
+    record_field("start",    RECORD_TIMESPEC, start),
+    record_field("end",      RECORD_TIMESPEC, end),
+    record_field("utime",    RECORD_TIMEVAL,  rusage.ru_utime),
+    record_field("stime",    RECORD_TIMEVAL,  rusage.ru_stime),
+    record_field("maxrss",   RECORD_LONG,     rusage.ru_maxrss),
+    record_field("ixrss",    RECORD_LONG,     rusage.ru_ixrss),
+    record_field("idrss",    RECORD_LONG,     rusage.ru_idrss),
+    record_field("isrss",    RECORD_LONG,     rusage.ru_isrss),
+    record_field("minflt",   RECORD_LONG,     rusage.ru_minflt),
+    record_field("majflt",   RECORD_LONG,     rusage.ru_majflt),
+    record_field("nswap",    RECORD_LONG,     rusage.ru_nswap),
+    record_field("inblock",  RECORD_LONG,     rusage.ru_inblock),
+    record_field("oublock",  RECORD_LONG,     rusage.ru_oublock),
+    record_field("msgsnd",   RECORD_LONG,     rusage.ru_msgsnd),
+    record_field("msgrcv",   RECORD_LONG,     rusage.ru_msgrcv),
+    record_field("nsignals", RECORD_LONG,     rusage.ru_nsignals),
+    record_field("nvcsw",    RECORD_LONG,     rusage.ru_nvcsw),
+    record_field("nivcsw",   RECORD_LONG,     rusage.ru_nivcsw),
+    record_field("status",   RECORD_INT,      status),
+    record_string_field("stdout", stdout, SHA256_HEX_SIZE - 1),
+    record_string_field("stderr", stderr, SHA256_HEX_SIZE - 1),
+    record_field("stdout_bytes", RECORD_LONG, capture[PROGRAM_STDOUT].bytes),
+    record_field("stderr_bytes", RECORD_LONG, capture[PROGRAM_STDERR].bytes)};
+
+const size_t program_nfields =
+    sizeof(program_fields) / sizeof(struct record_field);
+
+const struct record_field compare_fields[] = {
+    record_field("variant", RECORD_UINT, variant)};
+
+const size_t compare_nfields =
+    sizeof(compare_fields) / sizeof(struct record_field);
+
+const struct record_field cache_fields[] = {
+    record_field("read_bytes", RECORD_LONG, read_bytes)};
+
+const size_t cache_nfields =
+    sizeof(cache_fields) / sizeof(struct record_field);
+
+const struct record_field phase_fields[] = {
+    record_field("phase_fork",    RECORD_LONG, phases.fork),
+    record_field("phase_setup",   RECORD_LONG, phases.setup),
+    record_field("phase_reap",    RECORD_LONG, phases.reap),
+    record_field("phase_collect", RECORD_LONG, phases.collect)};
+
+const size_t phase_nfields =
+    sizeof(phase_fields) / sizeof(struct record_field);
+
+const struct record_field exec_fields[] = {
+    record_field("exec_to_exit", RECORD_LONG, exec_to_exit),
+    record_field("fork_to_exit", RECORD_LONG, fork_to_exit)};
+
+const size_t exec_nfields =
+    sizeof(exec_fields) / sizeof(struct record_field);
+
+const struct record_field rate_fields[] = {
+    record_field("intended",  RECORD_TIMESPEC, intended),
+    record_field("start_lag", RECORD_LONG,     start_lag),
+    record_field("latency",   RECORD_LONG,     latency)};
+
+const size_t rate_nfields =
+    sizeof(rate_fields) / sizeof(struct record_field);
+
+const struct record_field perf_fields[] = {
+    record_field("cycles",           RECORD_COUNTER,
+        perf.count[PERF_CYCLES]),
+    record_field("instructions",     RECORD_COUNTER,
+        perf.count[PERF_INSTRUCTIONS]),
+    record_field("cache_misses",     RECORD_COUNTER,
+        perf.count[PERF_CACHE_MISSES]),
+    record_field("branch_misses",    RECORD_COUNTER,
+        perf.count[PERF_BRANCH_MISSES]),
+    record_field("stalled_frontend", RECORD_COUNTER,
+        perf.count[PERF_STALLED_FRONTEND]),
+    record_field("stalled_backend",  RECORD_COUNTER,
+        perf.count[PERF_STALLED_BACKEND]),
+    record_field("perf_scale",       RECORD_COUNTER, perf.scale)};
+
+const size_t perf_nfields =
+    sizeof(perf_fields) / sizeof(struct record_field);
+
+const struct record_field timeline_fields[] = {
+    record_string_field("timeline", timeline.path, 64)};
+
+const size_t timeline_nfields =
+    sizeof(timeline_fields) / sizeof(struct record_field);
+
+const struct record_field cgroup_fields[] = {
+    record_field("cg_memory_peak",    RECORD_COUNTER, cgroup.memory_peak),
+    record_field("cg_usage_usec",     RECORD_COUNTER, cgroup.usage_usec),
+    record_field("cg_user_usec",      RECORD_COUNTER, cgroup.user_usec),
+    record_field("cg_system_usec",    RECORD_COUNTER, cgroup.system_usec),
+    record_field("cg_nr_throttled",   RECORD_COUNTER, cgroup.nr_throttled),
+    record_field("cg_throttled_usec", RECORD_COUNTER, cgroup.throttled_usec),
+    record_field("cg_io_rbytes",      RECORD_COUNTER, cgroup.io_rbytes),
+    record_field("cg_io_wbytes",      RECORD_COUNTER, cgroup.io_wbytes),
+    record_field("cg_pids_peak",      RECORD_COUNTER, cgroup.pids_peak)};
+
+const size_t cgroup_nfields =
+    sizeof(cgroup_fields) / sizeof(struct record_field);
+
+const struct record_field procstat_fields[] = {
+    record_field("sched_runtime",  RECORD_COUNTER, procstat.sched_runtime),
+    record_field("sched_delay",    RECORD_COUNTER, procstat.sched_delay),
+    record_field("sched_slices",   RECORD_COUNTER, procstat.sched_slices),
+    record_field("io_read_bytes",  RECORD_COUNTER, procstat.io_read_bytes),
+    record_field("io_write_bytes", RECORD_COUNTER, procstat.io_write_bytes),
+    record_field("io_syscr",       RECORD_COUNTER, procstat.io_syscr),
+    record_field("io_syscw",       RECORD_COUNTER, procstat.io_syscw),
+    record_field("main_nvcsw",     RECORD_COUNTER, procstat.nvcsw),
+    record_field("main_nivcsw",    RECORD_COUNTER, procstat.nivcsw)};
+
+const size_t procstat_nfields =
+    sizeof(procstat_fields) / sizeof(struct record_field);
+
+const struct record_field noise_fields[] = {
+    record_field("noise_cpu",        RECORD_COUNTER, noise.cpu),
+    record_field("psi_cpu_usec",     RECORD_COUNTER, noise.psi_cpu),
+    record_field("psi_memory_usec",  RECORD_COUNTER, noise.psi_memory),
+    record_field("psi_io_usec",      RECORD_COUNTER, noise.psi_io),
+    record_field("load_running",     RECORD_COUNTER, noise.running),
+    record_field("vm_pgscan",        RECORD_COUNTER, noise.pgscan),
+    record_field("vm_allocstall",    RECORD_COUNTER, noise.allocstall),
+    record_field("vm_compact_stall", RECORD_COUNTER, noise.compact_stall)};
+
+const size_t noise_nfields =
+    sizeof(noise_fields) / sizeof(struct record_field);
+
+static size_t record_field_size(const struct record_field *field) {
+    if (field->type == RECORD_STRING)
+        return (field->width + 7) & ~7;
+    return sizeof(int64_t);
+}
+
+int record_schema_add(
+    struct record_schema *schema,
+    const struct record_field *fields,
+    size_t nfields,
+    struct error_buffer *errbuf) {
+
+    if (schema->nfields + nfields > RECORD_MAX_FIELDS) {
+        snprintf(errbuf->s, errbuf->n,
+            "too many record fields, at most %i supported",
+            RECORD_MAX_FIELDS);
+        return -1;
+    }
+
+    for (size_t i=0; i<nfields; i++) {
+        schema->fields[schema->nfields++] = &fields[i];
+        schema->size += record_field_size(&fields[i]);
+    }
+
+    return 0;
+}
+
+// Everything is written to both out and (if set) copy
+#define record_each_out(schema, out) \
+    for (FILE *out = (schema)->out; out != NULL; \
+         out = out == (schema)->out ? (schema)->copy : NULL)
+
+void record_header_start(struct record_schema *schema) {
+    if (schema->out == NULL)
+        schema->out = stdout;
+    schema->headerlen = 0;
+    if (schema->format == RECORD_FORMAT_BINARY) {
+        record_each_out(schema, out)
+            fputs(RECORD_BINARY_MAGIC "\n", out);
+        schema->headerlen += strlen(RECORD_BINARY_MAGIC "\n");
+    }
+}
+
+void record_info(struct record_schema *schema, const char *fmt, ...) {
+    int n = 0;
+    record_each_out(schema, out) {
+        va_list ap;
+        va_start(ap, fmt);
+        n = vfprintf(out, fmt, ap);
+        va_end(ap);
+        fputc('\n', out);
+    }
+    if (n > 0)
+        schema->headerlen += n + 1;
+}
+
+static const char *record_binary_type(
+    const struct record_field *field,
+    char *buf, size_t n) {
+
+    switch (field->type) {
+    case RECORD_TIMESPEC:
+    case RECORD_TIMEVAL:
+        return "ns";
+    case RECORD_STRING:
+        snprintf(buf, n, "s%zu", record_field_size(field));
+        return buf;
+    default:
+        return "i64";
+    }
+}
+
+static size_t record_header_end_to(
+    struct record_schema *schema,
+    FILE *out) {
+
+    if (schema->format == RECORD_FORMAT_TEXT) {
+        for (unsigned int i=0; i<schema->nfields; i++) {
+            if (i > 0)
+                fputc(' ', out);
+            fputs(schema->fields[i]->name, out);
+        }
+        fputc('\n', out);
+        return 0;
+    }
+
+    char buf[32];
+    size_t n = fprintf(out, "fields=");
+    for (unsigned int i=0; i<schema->nfields; i++)
+        n += fprintf(out, "%s%s:%s", i > 0 ? " " : "",
+            schema->fields[i]->name,
+            record_binary_type(schema->fields[i], buf, sizeof(buf)));
+    n += fprintf(out, "\nrecsize=%zu\n\n", schema->size);
+
+    // pad so that records start 8 byte aligned
+    while ((schema->headerlen + n) % 8 != 0) {
+        fputc('\0', out);
+        n++;
+    }
+    return n;
+}
+
+void record_header_end(struct record_schema *schema) {
+    size_t n = 0;
+    record_each_out(schema, out)
+        n = record_header_end_to(schema, out);
+    schema->headerlen += n;
+}
+
+void record_trailer_start(struct record_schema *schema) {
+    if (schema->format == RECORD_FORMAT_BINARY)
+        record_each_out(schema, out)
+            fputs(RECORD_TRAILER_MAGIC "\n", out);
+}
+
+static void record_write_text(
+    struct record_schema *schema,
+    FILE *out,
+    const struct program_result *res) {
+
+    for (unsigned int i=0; i<schema->nfields; i++) {
+        const struct record_field *field = schema->fields[i];
+        const void *val = (const char *) res + field->offset;
+        if (i > 0)
+            fputc(' ', out);
+        switch (field->type) {
+        case RECORD_TIMESPEC: {
+            const struct timespec *ts = val;
+            fprintf(out, "%lus,%luns", ts->tv_sec, ts->tv_nsec);
+            break;
+        }
+        case RECORD_TIMEVAL: {
+            const struct timeval *tv = val;
+            fprintf(out, "%lus,%luus", tv->tv_sec, tv->tv_usec);
+            break;
+        }
+        case RECORD_LONG:
+            fprintf(out, "%ld", *(const long *) val);
+            break;
+        case RECORD_COUNTER:
+            if (*(const long *) val < 0)
+                fputc('-', out);
+            else
+                fprintf(out, "%ld", *(const long *) val);
+            break;
+        case RECORD_INT:
+            fprintf(out, "%d", *(const int *) val);
+            break;
+        case RECORD_UINT:
+            fprintf(out, "%u", *(const unsigned int *) val);
+            break;
+        case RECORD_STRING: {
+            const char *s = *(const char * const *) val;
+            fputs(s != NULL ? s : "-", out);
+            break;
+        }
+        }
+    }
+    fputc('\n', out);
+}
+
+int64_t record_value(
+    const struct record_field *field,
+    const struct program_result *res) {
+
+    const void *val = (const char *) res + field->offset;
+    switch (field->type) {
+    case RECORD_TIMESPEC: {
+        const struct timespec *ts = val;
+        return (int64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+    }
+    case RECORD_TIMEVAL: {
+        const struct timeval *tv = val;
+        return (int64_t) tv->tv_sec * 1000000000 + tv->tv_usec * 1000;
+    }
+    case RECORD_LONG:
+    case RECORD_COUNTER:
+        return *(const long *) val;
+    case RECORD_INT:
+        return *(const int *) val;
+    case RECORD_UINT:
+        return *(const unsigned int *) val;
+    default:
+        return 0;
+    }
+}
+
+static void record_write_binary(
+    struct record_schema *schema,
+    FILE *out,
+    const struct program_result *res) {
+
+    for (unsigned int i=0; i<schema->nfields; i++) {
+        const struct record_field *field = schema->fields[i];
+        if (field->type == RECORD_STRING) {
+            const char *s = *(const char * const *)
+                ((const char *) res + field->offset);
+            size_t size = record_field_size(field);
+            size_t len = s != NULL ? strnlen(s, size) : 0;
+            fwrite(s, 1, len, out);
+            while (len++ < size)
+                fputc('\0', out);
+            continue;
+        }
+        int64_t v = htole64(record_value(field, res));
+        fwrite(&v, sizeof(v), 1, out);
+    }
+}
+
+void record_write(
+    struct record_schema *schema,
+    const struct program_result *res) {
+
+    record_each_out(schema, out)
+        if (schema->format == RECORD_FORMAT_BINARY)
+            record_write_binary(schema, out, res);
+        else
+            record_write_text(schema, out, res);
+}
+
+void record_flush(struct record_schema *schema) {
+    record_each_out(schema, out)
+        fflush(out);
+}
@@ -0,0 +1,165 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "error.h"
+#include "program.h"
+
+// Records are output as a header of key=value info lines followed by one
+// record per run, each made up of the fields in a record_schema.
+//
+// The text format is the default: the header ends with a line of
+// space-separated field names, and each record is a line of
+// space-separated values.
+//
+// The binary format starts with a RECORD_BINARY_MAGIC line, followed by
+// the same info lines, then "fields=" listing name:type pairs, then
+// "recsize=", then an empty line; after padding to an 8 byte boundary the
+// records follow as fixed-size little-endian data.
+//
+// Either format may end with a trailer of more info lines written once
+// sampling has finished; in the binary format it starts with a
+// RECORD_TRAILER_MAGIC line right after the last record.  Binary field types
+// are "ns" for times as int64 nanoseconds, "i64" for integers and "sN" for
+// NUL-padded strings of N bytes; unavailable counters are negative.
+
+#define RECORD_BINARY_MAGIC "measure-binary 1"
+#define RECORD_TRAILER_MAGIC "measure-trailer 1"
+
+#define RECORD_FORMAT_TEXT   0
+#define RECORD_FORMAT_BINARY 1
+
+#define RECORD_TIMESPEC 0 // struct timespec
+#define RECORD_TIMEVAL  1 // struct timeval
+#define RECORD_LONG     2 // long
+#define RECORD_INT      3 // int
+#define RECORD_UINT     4 // unsigned int
+#define RECORD_STRING   5 // const char *
+#define RECORD_COUNTER  6 // long, negative if unavailable (text shows '-')
+
+struct record_field {
+    const char *name;
+    int type;
+    size_t offset; // of the value within struct program_result
+    size_t width;  // of RECORD_STRING values in the binary format
+};
+
+#define record_field(name, type, member) \
+    {name, type, offsetof(struct program_result, member), 0}
+
+#define record_string_field(name, member, width) \
+    {name, RECORD_STRING, offsetof(struct program_result, member), width}
+
+#define RECORD_MAX_FIELDS 128
+
+struct record_schema {
+    int format;
+    FILE *out;
+    FILE *copy; // if set, also receives everything written to out
+    unsigned int nfields;
+    const struct record_field *fields[RECORD_MAX_FIELDS];
+    size_t size;
+    size_t headerlen;
+};
+
+#define record_schema_init() {RECORD_FORMAT_TEXT, NULL, NULL, 0, {NULL}, 0, 0}
+
+// The base fields that every record has
+extern const struct record_field program_fields[];
+extern const size_t program_nfields;
+
+// Which program of a comparison each run was of
+extern const struct record_field compare_fields[];
+extern const size_t compare_nfields;
+
+// Bytes each run read from disk, to go with --cache
+extern const struct record_field cache_fields[];
+extern const size_t cache_nfields;
+
+// Durations of measure's own phases around each run, see program.h
+extern const struct record_field phase_fields[];
+extern const size_t phase_nfields;
+
+// Durations to each run's end from its exec and its fork, see program.h
+extern const struct record_field exec_fields[];
+extern const size_t exec_nfields;
+
+// When each run was meant to start with --rate, and its delays from then,
+// see rate.h
+extern const struct record_field rate_fields[];
+extern const size_t rate_nfields;
+
+// Hardware performance counter fields, see perf.h
+extern const struct record_field perf_fields[];
+extern const size_t perf_nfields;
+
+// The timeline side file, see timeline.h
+extern const struct record_field timeline_fields[];
+extern const size_t timeline_nfields;
+
+// Per-run cgroup statistics, see cgroup.h
+extern const struct record_field cgroup_fields[];
+extern const size_t cgroup_nfields;
+
+// What /proc had about each run before it was reaped, see procstat.h
+extern const struct record_field procstat_fields[];
+extern const size_t procstat_nfields;
+
+// What the rest of the machine was doing during each run, see noise.h
+extern const struct record_field noise_fields[];
+extern const size_t noise_nfields;
+
+int record_schema_add(
+    struct record_schema *schema,
+    const struct record_field *fields,
+    size_t nfields,
+    struct error_buffer *errbuf);
+
+// Starts the header, must be called before any record_info()
+void record_header_start(struct record_schema *schema);
+
+// Outputs a "key=value" header line
+void record_info(struct record_schema *schema, const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+// Ends the header by describing the schema's fields
+void record_header_end(struct record_schema *schema);
+
+// Starts the trailer after the last record, to be followed by
+// record_info() lines
+void record_trailer_start(struct record_schema *schema);
+
+// The value of a non-string field as it's written in the binary format,
+// i.e. times in nanoseconds
+int64_t record_value(
+    const struct record_field *field,
+    const struct program_result *res);
+
+void record_write(
+    struct record_schema *schema,
+    const struct program_result *res);
+
+void record_flush(struct record_schema *schema);
+
+#endif // _RECORD_H
@@ -0,0 +1,141 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "sha256.h"
+
+// A straightforward implementation of SHA-256 as specified in FIPS 180-4
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ror(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(struct sha256 *ctx, const unsigned char *p) {
+    uint32_t w[64];
+    for (int i=0; i<16; i++)
+        w[i] = (uint32_t) p[4*i] << 24 | (uint32_t) p[4*i+1] << 16 |
+               (uint32_t) p[4*i+2] << 8 | p[4*i+3];
+    for (int i=16; i<64; i++) {
+        uint32_t s0 = ror(w[i-15], 7) ^ ror(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = ror(w[i-2], 17) ^ ror(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1],
+             c = ctx->state[2], d = ctx->state[3],
+             e = ctx->state[4], f = ctx->state[5],
+             g = ctx->state[6], h = ctx->state[7];
+
+    for (int i=0; i<64; i++) {
+        uint32_t s1 = ror(e, 6) ^ ror(e, 11) ^ ror(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + k[i] + w[i];
+        uint32_t s0 = ror(a, 2) ^ ror(a, 13) ^ ror(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    ctx->state[0] += a; ctx->state[1] += b;
+    ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f;
+    ctx->state[6] += g; ctx->state[7] += h;
+}
+
+void sha256_init(struct sha256 *ctx) {
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(ctx->state, init, sizeof(init));
+    ctx->len = 0;
+}
+
+void sha256_update(struct sha256 *ctx, const void *data, size_t len) {
+    const unsigned char *p = data;
+    size_t have = ctx->len % 64;
+    ctx->len += len;
+
+    if (have > 0) {
+        size_t need = 64 - have;
+        if (len < need) {
+            memcpy(ctx->buf + have, p, len);
+            return;
+        }
+        memcpy(ctx->buf + have, p, need);
+        sha256_block(ctx, ctx->buf);
+        p += need;
+        len -= need;
+    }
+
+    for (; len >= 64; p += 64, len -= 64)
+        sha256_block(ctx, p);
+
+    memcpy(ctx->buf, p, len);
+}
+
+void sha256_final(struct sha256 *ctx, unsigned char digest[SHA256_DIGEST_SIZE]) {
+    uint64_t bits = ctx->len * 8;
+    size_t have = ctx->len % 64;
+
+    ctx->buf[have++] = 0x80;
+    if (have > 56) {
+        memset(ctx->buf + have, 0, 64 - have);
+        sha256_block(ctx, ctx->buf);
+        have = 0;
+    }
+    memset(ctx->buf + have, 0, 56 - have);
+    for (int i=0; i<8; i++)
+        ctx->buf[56 + i] = bits >> (56 - 8 * i);
+    sha256_block(ctx, ctx->buf);
+
+    for (int i=0; i<8; i++) {
+        digest[4*i]   = ctx->state[i] >> 24;
+        digest[4*i+1] = ctx->state[i] >> 16;
+        digest[4*i+2] = ctx->state[i] >> 8;
+        digest[4*i+3] = ctx->state[i];
+    }
+}
+
+void sha256_final_hex(struct sha256 *ctx, char hex[SHA256_HEX_SIZE]) {
+    static const char digits[] = "0123456789abcdef";
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    sha256_final(ctx, digest);
+    for (int i=0; i<SHA256_DIGEST_SIZE; i++) {
+        hex[2*i]   = digits[digest[i] >> 4];
+        hex[2*i+1] = digits[digest[i] & 0xf];
+    }
+    hex[2*SHA256_DIGEST_SIZE] = '\0';
+}
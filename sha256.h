@@ -0,0 +1,43 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SHA256_H
+#define _SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE    (2 * SHA256_DIGEST_SIZE + 1)
+
+struct sha256 {
+    uint32_t state[8];
+    uint64_t len;
+    unsigned char buf[64];
+};
+
+void sha256_init(struct sha256 *ctx);
+
+void sha256_update(struct sha256 *ctx, const void *data, size_t len);
+
+void sha256_final(struct sha256 *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+// Finishes ctx, writing the digest as a NUL-terminated hex string
+void sha256_final_hex(struct sha256 *ctx, char hex[SHA256_HEX_SIZE]);
+
+#endif // _SHA256_H
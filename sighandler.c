@@ -44,6 +44,17 @@ void setup_signal_handlers(void) {
     sigaction(SIGPIPE, &act, NULL);
 }
 
+void reset_signal_handlers(void) {
+    struct sigaction act;
+    memset(&act, 0, sizeof(struct sigaction));
+    act.sa_handler = SIG_DFL;
+
+    sigaction(SIGTERM, &act, NULL);
+    sigaction(SIGINT,  &act, NULL);
+    sigaction(SIGHUP,  &act, NULL);
+    sigaction(SIGPIPE, &act, NULL);
+}
+
 void exit_cleanly_from_signal(int signo) {
     // Restore default signal action for and unblock SIGTERM and SIGINT so
     // that repeated signal during teardown will cause immediate exit; in
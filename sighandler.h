@@ -21,6 +21,9 @@
 
 void setup_signal_handlers(void);
 
+// Restores default signal actions, for use in a child before exec.
+void reset_signal_handlers(void);
+
 void polite_kill(pid_t pid);
 
 #endif // _MEASURE_SIGHANDLER_H_
@@ -0,0 +1,248 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+static const double stats_percentiles[] = {50, 90, 99, 99.9};
+
+int stats_setup(
+    struct stats *stats,
+    const struct record_schema *schema,
+    struct error_buffer *errbuf) {
+
+    stats->metrics = calloc(schema->nfields + 1, sizeof(struct stats_metric));
+    if (stats->metrics == NULL) {
+        strncpy(errbuf->s, "calloc() failed", errbuf->n);
+        return -1;
+    }
+
+    stats->nmetrics = 0;
+    stats->nruns = 0;
+    stats->metrics[stats->nmetrics++].name = "wallclock";
+    for (unsigned int i=0; i<schema->nfields; i++) {
+        const struct record_field *field = schema->fields[i];
+        if (field->type == RECORD_STRING || field->type == RECORD_TIMESPEC)
+            continue;
+        struct stats_metric *metric = &stats->metrics[stats->nmetrics++];
+        metric->name  = field->name;
+        metric->field = field;
+    }
+
+    return 0;
+}
+
+static int stats_bucket(int64_t v) {
+    if (v < STATS_SUB_COUNT)
+        return v;
+    int e = 63 - __builtin_clzll(v);
+    return ((e - STATS_SUB_BITS + 1) << STATS_SUB_BITS) +
+        (int) ((v >> (e - STATS_SUB_BITS)) - STATS_SUB_COUNT);
+}
+
+// The middle of the range of values that fall in bucket i
+static int64_t stats_bucket_value(int i) {
+    if (i < STATS_SUB_COUNT)
+        return i;
+    int shift = (i >> STATS_SUB_BITS) - 1;
+    int64_t low = (int64_t) (STATS_SUB_COUNT + (i & (STATS_SUB_COUNT - 1)))
+        << shift;
+    return low + (((int64_t) 1 << shift) >> 1);
+}
+
+void stats_add_value(struct stats_metric *metric, int64_t v) {
+    if (v < 0)
+        return;
+
+    metric->n++;
+    double delta = v - metric->mean;
+    metric->mean += delta / metric->n;
+    metric->m2 += delta * (v - metric->mean);
+
+    if (metric->n == 1 || v < metric->min)
+        metric->min = v;
+    if (metric->n == 1 || v > metric->max)
+        metric->max = v;
+
+    metric->buckets[stats_bucket(v)]++;
+}
+
+int64_t stats_metric_value(
+    const struct stats_metric *metric,
+    const struct program_result *res) {
+
+    if (metric->field != NULL)
+        return record_value(metric->field, res);
+    return (int64_t) (res->end.tv_sec - res->start.tv_sec) * 1000000000
+        + res->end.tv_nsec - res->start.tv_nsec;
+}
+
+void stats_add(struct stats *stats, const struct program_result *res) {
+    stats->nruns++;
+    for (unsigned int i=0; i<stats->nmetrics; i++)
+        stats_add_value(&stats->metrics[i],
+            stats_metric_value(&stats->metrics[i], res));
+}
+
+int64_t stats_percentile(const struct stats_metric *metric, double p) {
+    if (metric->n == 0)
+        return -1;
+
+    uint64_t rank = ceil(p / 100 * metric->n);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int i=0; i<STATS_NBUCKETS; i++) {
+        seen += metric->buckets[i];
+        if (seen >= rank) {
+            int64_t v = stats_bucket_value(i);
+            if (v < metric->min)
+                return metric->min;
+            if (v > metric->max)
+                return metric->max;
+            return v;
+        }
+    }
+    return metric->max;
+}
+
+double stats_stddev(const struct stats_metric *metric) {
+    if (metric->n < 2)
+        return 0;
+    return sqrt(metric->m2 / (metric->n - 1));
+}
+
+// The standard normal quantile function, by Acklam's rational
+// approximation (relative error below 1.2e-9)
+static double normal_quantile(double p) {
+    static const double a[] = {
+        -3.969683028665376e+01,  2.209460984245205e+02,
+        -2.759285104469687e+02,  1.383577518672690e+02,
+        -3.066479806614716e+01,  2.506628277459239e+00};
+    static const double b[] = {
+        -5.447609879822406e+01,  1.615858368580409e+02,
+        -1.556989798598866e+02,  6.680131188771972e+01,
+        -1.328068155288572e+01};
+    static const double c[] = {
+        -7.784894002430293e-03, -3.223964580411365e-01,
+        -2.400758277161838e+00, -2.549732539343734e+00,
+         4.374664141464968e+00,  2.938163982698783e+00};
+    static const double d[] = {
+         7.784695709041462e-03,  3.224671290700398e-01,
+         2.445134137142996e+00,  3.754408661907416e+00};
+
+    if (p < 0.02425) {
+        double q = sqrt(-2 * log(p));
+        return (((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5]) /
+            ((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1);
+    }
+    if (p > 1 - 0.02425)
+        return -normal_quantile(1 - p);
+    double q = p - 0.5, r = q * q;
+    return (((((a[0]*r + a[1])*r + a[2])*r + a[3])*r + a[4])*r + a[5])*q /
+        (((((b[0]*r + b[1])*r + b[2])*r + b[3])*r + b[4])*r + 1);
+}
+
+// Student's t quantile function, by the Cornish-Fisher expansion about the
+// normal quantile; good to a few parts per thousand from 3 degrees of
+// freedom up.
+static double t_quantile(double p, long df) {
+    double z = normal_quantile(p);
+    double z2 = z * z, n = df;
+    return z
+        + z * (z2 + 1) / (4 * n)
+        + z * ((5 * z2 + 16) * z2 + 3) / (96 * n * n)
+        + z * (((3 * z2 + 19) * z2 + 17) * z2 - 15) / (384 * n * n * n)
+        + z * ((((79 * z2 + 776) * z2 + 1482) * z2 - 1920) * z2 - 945)
+            / (92160 * n * n * n * n);
+}
+
+double stats_ci_halfwidth(const struct stats_metric *metric, double confidence) {
+    if (metric->n < 2)
+        return -1;
+    double t = t_quantile(1 - (1 - confidence) / 2, metric->n - 1);
+    return t * stats_stddev(metric) / sqrt(metric->n);
+}
+
+struct stats_metric *stats_find(struct stats *stats, const char *name) {
+    for (unsigned int i=0; i<stats->nmetrics; i++)
+        if (strcmp(stats->metrics[i].name, name) == 0)
+            return &stats->metrics[i];
+    return NULL;
+}
+
+void stats_write(const struct stats *stats, FILE *out) {
+    fprintf(out, STATS_MAGIC "\nruns=%ld\nsubbits=%i\n",
+        stats->nruns, STATS_SUB_BITS);
+
+    for (unsigned int i=0; i<stats->nmetrics; i++) {
+        const struct stats_metric *metric = &stats->metrics[i];
+        fprintf(out, "%s n=%ld mean=%.17g m2=%.17g stddev=%.17g",
+            metric->name, metric->n, metric->mean, metric->m2,
+            stats_stddev(metric));
+        if (metric->n > 0) {
+            fprintf(out, " min=%lld max=%lld",
+                (long long) metric->min, (long long) metric->max);
+            for (int j=0; j<sizeof(stats_percentiles) / sizeof(double); j++)
+                fprintf(out, " p%g=%lld", stats_percentiles[j],
+                    (long long) stats_percentile(metric,
+                        stats_percentiles[j]));
+        }
+        fputs(" buckets=", out);
+        const char *sep = "";
+        for (int j=0; j<STATS_NBUCKETS; j++)
+            if (metric->buckets[j] > 0) {
+                fprintf(out, "%s%i:%llu", sep, j,
+                    (unsigned long long) metric->buckets[j]);
+                sep = ",";
+            }
+        fputc('\n', out);
+    }
+}
+
+int stats_save(
+    const struct stats *stats,
+    const char *path,
+    struct error_buffer *errbuf) {
+
+    char tmppath[PATH_MAX];
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+    FILE *out = fopen(tmppath, "w");
+    if (out == NULL) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to open %s, %s", tmppath, strerror(errno));
+        return -1;
+    }
+
+    stats_write(stats, out);
+    if (fclose(out) != 0 || rename(tmppath, path) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to write %s, %s", path, strerror(errno));
+        unlink(tmppath);
+        return -1;
+    }
+
+    return 0;
+}
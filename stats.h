@@ -0,0 +1,107 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "error.h"
+#include "record.h"
+
+// Streaming statistics over every numeric field of the records written,
+// plus wallclock (end - start); absolute times (the other timespec fields)
+// are left out.  Each metric keeps a Welford mean and variance, its min
+// and max, and a log-bucketed histogram for percentiles, all in constant
+// space regardless of how many runs there are.
+//
+// Histogram buckets hold values exactly below 2^STATS_SUB_BITS, above
+// that each power of two is split into 2^STATS_SUB_BITS buckets, so
+// percentiles are within 1/2^STATS_SUB_BITS of the true value.  Counts in
+// the same bucket of summaries with equal sub bits merge exactly.
+//
+// Summaries are written as a STATS_MAGIC line, runs= and subbits= lines,
+// then a line per metric of its name followed by space-separated
+// key=value pairs: n, mean, m2 (the sum of squared differences from the
+// mean), stddev, min, max, p50, p90, p99, p99.9 and buckets, a comma
+// separated list of index:count pairs of the non-empty buckets.
+
+#define STATS_MAGIC "measure-stats 1"
+
+#define STATS_SUB_BITS  5
+#define STATS_SUB_COUNT (1 << STATS_SUB_BITS)
+#define STATS_NBUCKETS  ((64 - STATS_SUB_BITS) * STATS_SUB_COUNT)
+
+struct stats_metric {
+    const char *name;
+    const struct record_field *field; // NULL for wallclock
+    long n;
+    double mean;
+    double m2;
+    int64_t min;
+    int64_t max;
+    uint64_t buckets[STATS_NBUCKETS];
+};
+
+struct stats {
+    unsigned int nmetrics;
+    struct stats_metric *metrics;
+    long nruns;
+};
+
+#define stats_init() {0, NULL, 0}
+
+// Sets up a metric for each numeric field of schema
+int stats_setup(
+    struct stats *stats,
+    const struct record_schema *schema,
+    struct error_buffer *errbuf);
+
+void stats_add(struct stats *stats, const struct program_result *res);
+
+// The metric's value for a result
+int64_t stats_metric_value(
+    const struct stats_metric *metric,
+    const struct program_result *res);
+
+// Adds a single value to a metric, negative values are unavailable and
+// so are skipped.
+void stats_add_value(struct stats_metric *metric, int64_t v);
+
+// The value at percentile p (0-100), -1 if there are no values
+int64_t stats_percentile(const struct stats_metric *metric, double p);
+
+double stats_stddev(const struct stats_metric *metric);
+
+// The half-width of the two-sided Student's t confidence interval (e.g.
+// confidence 0.95) of the metric's mean, -1 with fewer than two values.
+double stats_ci_halfwidth(const struct stats_metric *metric, double confidence);
+
+// Finds a metric by name, NULL if there's no such metric
+struct stats_metric *stats_find(struct stats *stats, const char *name);
+
+void stats_write(const struct stats *stats, FILE *out);
+
+// Writes a summary to path, replacing any previous summary atomically
+int stats_save(
+    const struct stats *stats,
+    const char *path,
+    struct error_buffer *errbuf);
+
+#endif // _STATS_H
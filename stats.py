@@ -0,0 +1,44 @@
+#!/usr/bin/python
+# Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+#
+# This file is part of measure, a program to measure programs.
+#
+# Measure is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Measure is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+
+import functools
+import sys
+from measure import Stats
+
+# Merges summaries written by sample --stats, outputting the merged summary
+# or a table of each metric's statistics.
+
+import argparse
+parser = argparse.ArgumentParser()
+parser.add_argument('--table', '-t', action='store_true',
+    help='Output a table of each metric rather than a mergeable summary')
+parser.add_argument('files', metavar='FILE', nargs='*',
+    help='Summaries to merge, use STDIN if none given')
+args = parser.parse_args()
+
+stats = functools.reduce(Stats.merge, map(Stats.load, args.files or [sys.stdin]))
+
+if args.table:
+    print('metric n mean stddev min max',
+          *('p%s' % format(p, 'g') for p in Stats.percentiles))
+    for metric in stats.metrics.values():
+        print(metric.name, metric.n, round(metric.mean, 2),
+              round(metric.stddev, 2), metric.min, metric.max,
+              *(metric.percentile(p) for p in Stats.percentiles))
+else:
+    print(stats)
@@ -0,0 +1,129 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "store.h"
+
+static int mkdir_exists(const char *path, struct error_buffer *errbuf) {
+    if (mkdir(path, 0777) < 0 && errno != EEXIST) {
+        snprintf(errbuf->s, errbuf->n,
+            "mkdir(%s) failed, %s", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int store_open(
+    struct store *store,
+    const char *dir,
+    struct error_buffer *errbuf) {
+
+    if (mkdir_exists(dir, errbuf) < 0)
+        return -1;
+
+    store->dir = realpath(dir, NULL);
+    if (store->dir == NULL) {
+        snprintf(errbuf->s, errbuf->n,
+            "failed to resolve %s, %s", dir, strerror(errno));
+        return -1;
+    }
+
+    const char *subdirs[] = {"objects", "tmp", "runs"};
+    char path[PATH_MAX];
+    for (int i=0; i<sizeof(subdirs)/sizeof(char *); i++) {
+        snprintf(path, sizeof(path), "%s/%s", store->dir, subdirs[i]);
+        if (mkdir_exists(path, errbuf) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int store_tmp_template(
+    const struct store *store,
+    const char *name,
+    const char *suffix,
+    char *buf,
+    size_t size,
+    struct error_buffer *errbuf) {
+
+    if (snprintf(buf, size, "%s/tmp/%s_XXXXXX%s",
+            store->dir, name, suffix) >= size) {
+        snprintf(errbuf->s, errbuf->n,
+            "temporary file path too long in %s", store->dir);
+        return -1;
+    }
+    return 0;
+}
+
+int store_commit(
+    const struct store *store,
+    const char *tmppath,
+    const char *hash,
+    const char *suffix,
+    struct error_buffer *errbuf) {
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/objects/%.2s", store->dir, hash);
+    if (mkdir_exists(path, errbuf) < 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "%s/objects/%.2s/%s%s",
+        store->dir, hash, hash + 2, suffix);
+    if (link(tmppath, path) < 0 && errno != EEXIST) {
+        snprintf(errbuf->s, errbuf->n,
+            "link(%s, %s) failed, %s", tmppath, path, strerror(errno));
+        return -1;
+    }
+
+    if (unlink(tmppath) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "unlink(%s) failed, %s", tmppath, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+FILE *store_open_run(
+    const struct store *store,
+    struct error_buffer *errbuf) {
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/runs/run_XXXXXX", store->dir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "mkstemp() failed for %s, %s", path, strerror(errno));
+        return NULL;
+    }
+
+    FILE *f = fdopen(fd, "w");
+    if (f == NULL) {
+        snprintf(errbuf->s, errbuf->n,
+            "fdopen() failed for %s, %s", path, strerror(errno));
+        close(fd);
+    }
+    return f;
+}
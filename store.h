@@ -0,0 +1,69 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STORE_H
+#define _STORE_H
+
+#include <stdio.h>
+
+#include "error.h"
+
+// A content-addressed store of run outputs, laid out like:
+//   DIR/objects/ab/cdef...  outputs named by the SHA-256 of their
+//                           (uncompressed) content, plus any codec suffix
+//   DIR/tmp/                outputs still being written
+//   DIR/runs/run_XXXXXX     the sample data of each run of measure
+// Identical outputs are only stored once.
+
+struct store {
+    char *dir;
+};
+
+#define store_init() {NULL}
+
+// Creates the store's directories under dir as needed
+int store_open(
+    struct store *store,
+    const char *dir,
+    struct error_buffer *errbuf);
+
+// Writes a mkstemp(3) template for a temporary file into buf, followed by
+// suffix
+int store_tmp_template(
+    const struct store *store,
+    const char *name,
+    const char *suffix,
+    char *buf,
+    size_t size,
+    struct error_buffer *errbuf);
+
+// Moves a finished temporary file into the store as the object named by
+// hash and suffix, or just removes it if the object already exists.
+int store_commit(
+    const struct store *store,
+    const char *tmppath,
+    const char *hash,
+    const char *suffix,
+    struct error_buffer *errbuf);
+
+// Creates a new file under runs/ for sample data
+FILE *store_open_run(
+    const struct store *store,
+    struct error_buffer *errbuf);
+
+#endif // _STORE_H
@@ -0,0 +1,229 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "record.h"
+#include "template.h"
+
+// The param_NAME fields, pointing into program_result's params
+static struct record_field template_fields[TEMPLATE_MAX_PARAMS];
+
+int template_param_parse(
+    struct template_params *params,
+    const char *arg,
+    struct error_buffer *errbuf) {
+
+    if (params->nparams >= TEMPLATE_MAX_PARAMS) {
+        snprintf(errbuf->s, errbuf->n,
+            "too many parameters, at most %i", TEMPLATE_MAX_PARAMS);
+        return -1;
+    }
+    struct template_param *param = &params->params[params->nparams];
+
+    size_t namelen = strcspn(arg, "=");
+    if (namelen == 0 || arg[namelen] != '=' || arg[namelen+1] == '\0') {
+        snprintf(errbuf->s, errbuf->n, "expected NAME=V1,V2,...");
+        return -1;
+    }
+    if (namelen >= TEMPLATE_NAME_MAX || strcspn(arg, "{}:") < namelen) {
+        snprintf(errbuf->s, errbuf->n, "invalid parameter name");
+        return -1;
+    }
+    for (int i=0; i<params->nparams; i++)
+        if (strncmp(params->params[i].name, arg, namelen) == 0 &&
+            params->params[i].name[namelen] == '\0') {
+            snprintf(errbuf->s, errbuf->n, "parameter %.*s given twice",
+                (int) namelen, arg);
+            return -1;
+        }
+
+    snprintf(param->field, sizeof(param->field), "param_%.*s",
+        (int) namelen, arg);
+    param->name = param->field + 6;
+    param->arg  = arg;
+
+    char *values = strdup(arg + namelen + 1);
+    if (values == NULL) {
+        strncpy(errbuf->s, "strdup() failed", errbuf->n);
+        return -1;
+    }
+    param->nvalues = 0;
+    char *save = NULL;
+    for (char *v = strtok_r(values, ",", &save); v != NULL;
+         v = strtok_r(NULL, ",", &save)) {
+        if (param->nvalues >= TEMPLATE_MAX_VALUES) {
+            snprintf(errbuf->s, errbuf->n,
+                "too many values, at most %i", TEMPLATE_MAX_VALUES);
+            return -1;
+        }
+        param->values[param->nvalues++] = v;
+    }
+    if (param->nvalues == 0) {
+        snprintf(errbuf->s, errbuf->n, "no values");
+        return -1;
+    }
+
+    params->nparams++;
+    return 0;
+}
+
+unsigned long template_ncombos(const struct template_params *params) {
+    unsigned long n = 1;
+    for (int i=0; i<params->nparams; i++)
+        n *= params->params[i].nvalues;
+    return n;
+}
+
+void template_combo(
+    const struct template_params *params,
+    unsigned long combo,
+    const char *values[]) {
+
+    for (int i=params->nparams-1; i>=0; i--) {
+        const struct template_param *param = &params->params[i];
+        values[i] = param->values[combo % param->nvalues];
+        combo /= param->nvalues;
+    }
+}
+
+// Matches a placeholder at s, returning its length or 0 if there isn't
+// one; param is set to the index of a parameter placeholder's parameter,
+// -2 if it's of an unknown one, or -1 for the others
+static size_t template_match(
+    const char *s,
+    const struct template_params *params,
+    int *param) {
+
+    static const char *names[] = {"{run}", "{slot}", "{tmpdir}"};
+    *param = -1;
+    for (int i=0; i<sizeof(names)/sizeof(names[0]); i++)
+        if (strncmp(s, names[i], strlen(names[i])) == 0)
+            return strlen(names[i]);
+
+    if (strncmp(s, "{param:", 7) != 0)
+        return 0;
+    size_t len = strcspn(s + 7, "{}");
+    if (s[7 + len] != '}')
+        return 0;
+    *param = -2;
+    for (int i=0; i<params->nparams; i++)
+        if (strncmp(params->params[i].name, s + 7, len) == 0 &&
+            params->params[i].name[len] == '\0')
+            *param = i;
+    return 7 + len + 1;
+}
+
+int template_check(
+    const char * const *argv,
+    const struct template_params *params,
+    int *usestmpdir,
+    struct error_buffer *errbuf) {
+
+    int templated = 0;
+    *usestmpdir = 0;
+    for (; *argv != NULL; argv++)
+        for (const char *s = strchr(*argv, '{'); s != NULL;
+             s = strchr(s + 1, '{')) {
+            int param;
+            size_t len = template_match(s, params, &param);
+            if (len == 0)
+                continue;
+            if (param == -2) {
+                snprintf(errbuf->s, errbuf->n,
+                    "unknown parameter in %.*s", (int) len, s);
+                return -1;
+            }
+            if (strncmp(s, "{tmpdir}", 8) == 0)
+                *usestmpdir = 1;
+            templated = 1;
+        }
+    return templated;
+}
+
+size_t template_expand(
+    const char *arg,
+    const struct template_params *params,
+    const struct template_vars *vars,
+    char *out,
+    size_t size) {
+
+    size_t n = 0;
+#define template_put(s, len) do { \
+        size_t _len = (len); \
+        if (n < size) \
+            memcpy(out + n, (s), n + _len < size ? _len : size - n); \
+        n += _len; \
+    } while (0)
+
+    while (*arg != '\0') {
+        const char *brace = strchrnul(arg, '{');
+        template_put(arg, brace - arg);
+        arg = brace;
+        if (*arg == '\0')
+            break;
+
+        int param;
+        size_t len = template_match(arg, params, &param);
+        if (len == 0 || param == -2) {
+            template_put(arg, 1);
+            arg++;
+            continue;
+        }
+        arg += len;
+
+        char num[32];
+        const char *value = num;
+        if (param >= 0)
+            value = vars->values[param];
+        else if (len == 5)
+            snprintf(num, sizeof(num), "%lu", vars->run);
+        else if (len == 6)
+            snprintf(num, sizeof(num), "%u", vars->slot);
+        else
+            value = vars->tmpdir;
+        template_put(value, strlen(value));
+    }
+#undef template_put
+
+    if (size > 0)
+        out[n < size ? n : size - 1] = '\0';
+    return n;
+}
+
+int template_schema_add(
+    const struct template_params *params,
+    struct record_schema *schema,
+    struct error_buffer *errbuf) {
+
+    for (int i=0; i<params->nparams; i++) {
+        const struct template_param *param = &params->params[i];
+        size_t width = 0;
+        for (int j=0; j<param->nvalues; j++)
+            if (strlen(param->values[j]) > width)
+                width = strlen(param->values[j]);
+        struct record_field field = {param->field, RECORD_STRING,
+            offsetof(struct program_result, params) +
+            i * sizeof(const char *), width};
+        template_fields[i] = field;
+    }
+    return record_schema_add(schema, template_fields, params->nparams,
+        errbuf);
+}
@@ -0,0 +1,105 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEMPLATE_H
+#define _TEMPLATE_H
+
+#include <stddef.h>
+
+#include "error.h"
+
+struct record_schema;
+
+// Command arguments may vary from run to run through placeholders:
+//   {run}         the run's number, counting from 0
+//   {slot}        the pool slot it runs in
+//   {tmpdir}      a fresh directory made for the run, removed after it
+//   {param:NAME}  the run's value of parameter NAME
+// Any other braces are left alone.
+//
+// Parameters each have a list of values, and runs cycle through every
+// combination of them (their cross product), the first parameter varying
+// slowest.  Each record gets a param_NAME field of its values.
+
+#define TEMPLATE_MAX_PARAMS 8
+#define TEMPLATE_MAX_VALUES 64
+#define TEMPLATE_NAME_MAX   32
+
+struct template_param {
+    char field[TEMPLATE_NAME_MAX + 6]; // "param_" followed by the name
+    const char *name;                  // within field
+    const char *arg;                   // as given, NAME=V1,V2,...
+    unsigned int nvalues;
+    const char *values[TEMPLATE_MAX_VALUES];
+};
+
+struct template_params {
+    unsigned int nparams;
+    struct template_param params[TEMPLATE_MAX_PARAMS];
+};
+
+#define template_params_init() {0}
+
+// What the placeholders of a run expand to
+struct template_vars {
+    unsigned long run;
+    unsigned int slot;
+    const char *tmpdir;
+    const char * const *values; // of each parameter
+};
+
+// Parses a parameter as NAME=V1,V2,...
+int template_param_parse(
+    struct template_params *params,
+    const char *arg,
+    struct error_buffer *errbuf);
+
+// How many combinations of parameter values there are, 1 if there are no
+// parameters
+unsigned long template_ncombos(const struct template_params *params);
+
+// Points values at each parameter's value in the given combination
+void template_combo(
+    const struct template_params *params,
+    unsigned long combo,
+    const char *values[]);
+
+// Checks the placeholders in argv, returning 1 if any argument has any, 0
+// if none do, or -1 if one names an unknown parameter; usestmpdir is set
+// if any uses {tmpdir}
+int template_check(
+    const char * const *argv,
+    const struct template_params *params,
+    int *usestmpdir,
+    struct error_buffer *errbuf);
+
+// Expands arg into out like snprintf(), returning the expanded length
+size_t template_expand(
+    const char *arg,
+    const struct template_params *params,
+    const struct template_vars *vars,
+    char *out,
+    size_t size);
+
+// Adds a param_NAME string field for each parameter to schema
+int template_schema_add(
+    const struct template_params *params,
+    struct record_schema *schema,
+    struct error_buffer *errbuf);
+
+#endif // _TEMPLATE_H
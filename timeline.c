@@ -0,0 +1,238 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "procstat.h"
+#include "record.h"
+#include "timeline.h"
+
+static const char *timeline_schema =
+    "t:ns nprocs:i64 vsize:i64 rss:i64 shared:i64 pss:i64 swap:i64 "
+    "cpu:ns minflt:i64 majflt:i64";
+
+void timeline_reset(struct timeline *tl) {
+    tl->fd   = -1;
+    tl->out  = NULL;
+    tl->path = NULL;
+    tl->pid  = 0;
+}
+
+int timeline_open(
+    struct timeline *tl,
+    const char *template,
+    long interval,
+    pid_t pid,
+    struct error_buffer *errbuf) {
+
+    tl->pid = pid;
+    if (strlen(template) >= PATH_MAX) {
+        snprintf(errbuf->s, errbuf->n, "template too long, %s", template);
+        return -1;
+    }
+    tl->path = strcpy(tl->buf, template);
+
+    int fd = mkostemp(tl->path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        snprintf(errbuf->s, errbuf->n, "mkstemp() failed for %s, %s",
+            template, strerror(errno));
+        return -1;
+    }
+    fchmod(fd, S_IRUSR);
+
+    tl->out = fdopen(fd, "w");
+    if (tl->out == NULL) {
+        snprintf(errbuf->s, errbuf->n,
+            "fdopen() failed for %s, %s", tl->path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    long n = fprintf(tl->out,
+        RECORD_BINARY_MAGIC "\npid=%i\ninterval=%ld\n"
+        "fields=%s\nrecsize=%zu\n\n",
+        pid, interval, timeline_schema, TIMELINE_NFIELDS * sizeof(int64_t));
+    while (n++ % 8 != 0)
+        fputc('\0', tl->out);
+
+    tl->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tl->fd < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "timerfd_create() failed, %s", strerror(errno));
+        return -1;
+    }
+
+    struct itimerspec its;
+    its.it_interval.tv_sec  = interval / 1000000000;
+    its.it_interval.tv_nsec = interval % 1000000000;
+    its.it_value = its.it_interval;
+    if (timerfd_settime(tl->fd, 0, &its, NULL) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "timerfd_settime() failed, %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int timeline_tree(pid_t pid, pid_t *pids, int max) {
+    int n = 0;
+    if (max > 0)
+        pids[n++] = pid;
+
+    for (int i=0; i<n; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%i/task", pids[i]);
+        DIR *tasks = opendir(path);
+        if (tasks == NULL)
+            continue;
+        struct dirent *task;
+        while ((task = readdir(tasks)) != NULL) {
+            if (task->d_name[0] == '.')
+                continue;
+            char buf[4096];
+            if (procstat_file(buf, sizeof(buf), "/proc/%i/task/%s/children",
+                    pids[i], task->d_name) <= 0)
+                continue;
+            for (char *p = buf, *end; n < max; p = end) {
+                long child = strtol(p, &end, 10);
+                if (end == p)
+                    break;
+                pids[n++] = child;
+            }
+        }
+        closedir(tasks);
+    }
+
+    return n;
+}
+
+// Adds the value (in kB) of a "Key: N kB" line from smaps_rollup
+static void add_kb(const char *buf, const char *key, int64_t *sum) {
+    const char *p = strstr(buf, key);
+    if (p != NULL)
+        *sum += strtoll(p + strlen(key), NULL, 10) * 1024;
+}
+
+int timeline_sample(
+    struct timeline *tl,
+    const pid_t *pids,
+    int npids,
+    struct error_buffer *errbuf) {
+
+    static long pagesize = 0, ticks = 0;
+    if (pagesize == 0) {
+        pagesize = sysconf(_SC_PAGESIZE);
+        ticks    = sysconf(_SC_CLK_TCK);
+    }
+
+    uint64_t expirations;
+    if (read(tl->fd, &expirations, sizeof(expirations)) < 0 &&
+        errno != EAGAIN) {
+        snprintf(errbuf->s, errbuf->n,
+            "read of timeline timer failed, %s", strerror(errno));
+        return -1;
+    }
+
+    int64_t s[TIMELINE_NFIELDS] = {0};
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    s[0] = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+    for (int i=0; i<npids; i++) {
+        char buf[4096];
+        long size, resident, shared;
+        if (procstat_file(buf, sizeof(buf), "/proc/%i/statm",
+                pids[i]) <= 0 ||
+            sscanf(buf, "%ld %ld %ld", &size, &resident, &shared) != 3)
+            continue; // already gone
+        s[1]++;
+        s[2] += size * pagesize;
+        s[3] += resident * pagesize;
+        s[4] += shared * pagesize;
+
+        if (procstat_file(buf, sizeof(buf), "/proc/%i/smaps_rollup",
+                pids[i]) > 0) {
+            add_kb(buf, "\nPss:", &s[5]);
+            add_kb(buf, "\nSwap:", &s[6]);
+        }
+
+        // fields after the parenthesized comm, which may contain anything
+        char *p;
+        long minflt, cminflt, majflt, cmajflt, ut, st, cut, cst;
+        if (procstat_file(buf, sizeof(buf), "/proc/%i/stat", pids[i]) > 0 &&
+            (p = strrchr(buf, ')')) != NULL &&
+            sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u "
+                "%lu %lu %lu %lu %lu %lu %ld %ld",
+                &minflt, &cminflt, &majflt, &cmajflt,
+                &ut, &st, &cut, &cst) == 8) {
+            s[7] += (ut + st + cut + cst) * (1000000000 / ticks);
+            s[8] += minflt + cminflt;
+            s[9] += majflt + cmajflt;
+        }
+    }
+
+    for (int i=0; i<TIMELINE_NFIELDS; i++)
+        s[i] = htole64(s[i]);
+    if (fwrite(s, sizeof(s), 1, tl->out) != 1) {
+        snprintf(errbuf->s, errbuf->n,
+            "write to %s failed, %s", tl->path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int timeline_close(
+    struct timeline *tl,
+    struct error_buffer *errbuf) {
+
+    if (tl->fd >= 0) {
+        close(tl->fd);
+        tl->fd = -1;
+    }
+
+    if (tl->out != NULL) {
+        int r = fclose(tl->out);
+        tl->out = NULL;
+        if (r != 0) {
+            snprintf(errbuf->s, errbuf->n,
+                "failed to close %s, %s", tl->path, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void timeline_free(struct timeline *tl) {
+    if (tl->fd >= 0)
+        close(tl->fd);
+    if (tl->out != NULL)
+        fclose(tl->out);
+    timeline_reset(tl);
+}
@@ -0,0 +1,89 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TIMELINE_H
+#define _TIMELINE_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "error.h"
+
+// Timelines sample a running child's memory and cpu usage every interval
+// from /proc/<pid>/{statm,smaps_rollup,stat}, summed over it and its
+// descendants, into a side file of their own.  The side file is in the
+// binary record format (see record.h) with pid= and interval= info lines
+// and one record of TIMELINE_NFIELDS int64s per sample:
+//   t       sample time (ns, CLOCK_MONOTONIC_RAW like start and end)
+//   nprocs  processes sampled
+//   vsize   virtual memory size (bytes)
+//   rss     resident set size (bytes)
+//   shared  resident file-backed and shared memory (bytes)
+//   pss     proportional set size (bytes)
+//   swap    swapped out memory (bytes)
+//   cpu     user and system time, including reaped children (ns)
+//   minflt  minor faults, including reaped children
+//   majflt  major faults, including reaped children
+
+#define TIMELINE_NFIELDS 10
+
+// Most processes in a tree that are sampled
+#define TIMELINE_MAX_PROCS 1024
+
+struct timeline {
+    int fd;      // timerfd, -1 when not sampling
+    FILE *out;
+    char *path;  // name of the side file, in buf once open
+    char buf[PATH_MAX];
+    pid_t pid;
+};
+
+void timeline_reset(struct timeline *tl);
+
+// Creates the side file named after template and arms a timer to fire
+// every interval ns; pool watches tl->fd and calls timeline_sample()
+// whenever it's readable.
+int timeline_open(
+    struct timeline *tl,
+    const char *template,
+    long interval,
+    pid_t pid,
+    struct error_buffer *errbuf);
+
+// Finds pid and its descendants through /proc/<pid>/task/*/children,
+// returning how many were stored in pids.
+int timeline_tree(pid_t pid, pid_t *pids, int max);
+
+// Consumes the timer's expirations and appends a sample summed over pids
+int timeline_sample(
+    struct timeline *tl,
+    const pid_t *pids,
+    int npids,
+    struct error_buffer *errbuf);
+
+// Stops the timer and finishes the side file
+int timeline_close(
+    struct timeline *tl,
+    struct error_buffer *errbuf);
+
+// Closes anything still open and frees the path
+void timeline_free(struct timeline *tl);
+
+#endif // _TIMELINE_H
@@ -0,0 +1,156 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "topology.h"
+
+int cpu_list_parse(
+    const char *list,
+    cpu_set_t *set,
+    struct error_buffer *errbuf) {
+
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long lo = strtol(p, &end, 10), hi;
+        if (end == p || lo < 0)
+            goto invalid;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo)
+                goto invalid;
+        } else
+            hi = lo;
+        if (hi >= CPU_SETSIZE) {
+            snprintf(errbuf->s, errbuf->n,
+                "cpu %li out of range in list \"%s\"", hi, list);
+            return -1;
+        }
+        for (long cpu=lo; cpu<=hi; cpu++)
+            CPU_SET(cpu, set);
+        p = end;
+        if (*p == ',')
+            p++;
+        else if (*p != '\0' && *p != '\n')
+            goto invalid;
+    }
+    return 0;
+
+invalid:
+    snprintf(errbuf->s, errbuf->n, "invalid cpu list \"%s\"", list);
+    return -1;
+}
+
+static int read_siblings(
+    int cpu,
+    cpu_set_t *siblings,
+    struct error_buffer *errbuf) {
+
+    char path[128];
+    snprintf(path, sizeof(path),
+        "/sys/devices/system/cpu/cpu%i/topology/thread_siblings_list", cpu);
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        // no topology information, the cpu is its own core
+        CPU_ZERO(siblings);
+        CPU_SET(cpu, siblings);
+        return 0;
+    }
+
+    char buf[256];
+    if (fgets(buf, sizeof(buf), f) == NULL) {
+        snprintf(errbuf->s, errbuf->n, "failed to read %s", path);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    return cpu_list_parse(buf, siblings, errbuf);
+}
+
+int topology_physical_cpus(
+    int *cpus,
+    int max,
+    const cpu_set_t *within,
+    struct error_buffer *errbuf) {
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "sched_getaffinity() failed, %s", strerror(errno));
+        return -1;
+    }
+    if (within != NULL)
+        CPU_AND(&allowed, &allowed, within);
+
+    int n = 0;
+    for (int cpu=0; cpu<CPU_SETSIZE && n<max; cpu++) {
+        if (! CPU_ISSET(cpu, &allowed))
+            continue;
+
+        cpu_set_t siblings;
+        if (read_siblings(cpu, &siblings, errbuf) < 0)
+            return -1;
+
+        // Only take the first allowed thread of each core
+        int first = 1;
+        for (int sib=0; sib<cpu; sib++)
+            if (CPU_ISSET(sib, &siblings) && CPU_ISSET(sib, &allowed)) {
+                first = 0;
+                break;
+            }
+        if (first)
+            cpus[n++] = cpu;
+    }
+
+    return n;
+}
+
+int topology_spare_cpus(
+    cpu_set_t *spare,
+    const cpu_set_t *busy,
+    struct error_buffer *errbuf) {
+
+    if (sched_getaffinity(0, sizeof(cpu_set_t), spare) < 0) {
+        snprintf(errbuf->s, errbuf->n,
+            "sched_getaffinity() failed, %s", strerror(errno));
+        return -1;
+    }
+
+    for (int cpu=0; cpu<CPU_SETSIZE; cpu++) {
+        if (! CPU_ISSET(cpu, busy))
+            continue;
+
+        cpu_set_t siblings;
+        if (read_siblings(cpu, &siblings, errbuf) < 0)
+            return -1;
+        CPU_SET(cpu, &siblings);
+        for (int sib=0; sib<CPU_SETSIZE; sib++)
+            if (CPU_ISSET(sib, &siblings))
+                CPU_CLR(sib, spare);
+    }
+
+    return CPU_COUNT(spare);
+}
@@ -0,0 +1,49 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TOPOLOGY_H
+#define _TOPOLOGY_H
+
+#include <sched.h>
+
+#include "error.h"
+
+// Parses a kernel style cpu list, e.g. "0-3,8,10-11", into set.
+int cpu_list_parse(
+    const char *list,
+    cpu_set_t *set,
+    struct error_buffer *errbuf);
+
+// Fills cpus with one cpu per physical core from our allowed cpu set (and
+// within, if not NULL), skipping SMT siblings as described by
+// /sys/devices/system/cpu; returns the number of cpus filled, or -1 on
+// error.
+int topology_physical_cpus(
+    int *cpus,
+    int max,
+    const cpu_set_t *within,
+    struct error_buffer *errbuf);
+
+// Fills spare with the cpus from our allowed cpu set that share no physical
+// core with any cpu in busy; returns how many there are, or -1 on error.
+int topology_spare_cpus(
+    cpu_set_t *spare,
+    const cpu_set_t *busy,
+    struct error_buffer *errbuf);
+
+#endif // _TOPOLOGY_H
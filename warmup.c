@@ -0,0 +1,84 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "warmup.h"
+
+int warmup_setup(struct warmup *w, struct error_buffer *errbuf) {
+    w->batches = calloc(WARMUP_MAX_RUNS / WARMUP_BATCH, sizeof(double));
+    if (w->batches == NULL) {
+        strncpy(errbuf->s, "calloc() failed", errbuf->n);
+        return -1;
+    }
+    w->nbatches = 0;
+    w->n = 0;
+    w->sum = 0;
+    return 0;
+}
+
+int warmup_add(struct warmup *w, int64_t v) {
+    if (w->nbatches >= WARMUP_MAX_RUNS / WARMUP_BATCH)
+        return 0;
+    w->n++;
+    w->sum += v;
+    if (w->n % WARMUP_BATCH == 0) {
+        w->batches[w->nbatches++] = w->sum / WARMUP_BATCH;
+        w->sum = 0;
+    }
+    return 1;
+}
+
+// The MSER truncation point in batches
+static int warmup_mser(const struct warmup *w) {
+    int k = w->nbatches;
+
+    // walk back from the end, accumulating the remaining batches' sums
+    double sum = 0, sumsq = 0, best = -1;
+    int bestd = 0;
+    for (int d=k-1; d>=0; d--) {
+        double y = w->batches[d];
+        sum += y;
+        sumsq += y * y;
+        if (d > k / 2)
+            continue;
+        int m = k - d;
+        double mser = (sumsq - sum * sum / m) / ((double) m * m);
+        if (best < 0 || mser <= best) {
+            best = mser;
+            bestd = d;
+        }
+    }
+    return bestd;
+}
+
+int warmup_truncation(const struct warmup *w) {
+    if (w->nbatches < WARMUP_MIN_BATCHES)
+        return -1;
+    int d = warmup_mser(w);
+    if (2 * d >= w->nbatches)
+        return -1;
+    return d * WARMUP_BATCH;
+}
+
+int warmup_best_truncation(const struct warmup *w) {
+    if (w->nbatches < WARMUP_MIN_BATCHES)
+        return 0;
+    return warmup_mser(w) * WARMUP_BATCH;
+}
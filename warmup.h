@@ -0,0 +1,61 @@
+/* Copyright (C) 2012, Joshua T Corbin <jcorbin@wunjo.org>
+ *
+ * This file is part of measure, a program to measure programs.
+ *
+ * Measure is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Measure is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Measure.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WARMUP_H
+#define _WARMUP_H
+
+#include <stdint.h>
+
+#include "error.h"
+
+// Warm-up detection by MSER-5, the marginal standard error rule over
+// batch means of 5 runs (White, 1997): the truncation point is the number
+// of leading batches d, of no more than half of them, that minimizes the
+// variance of the remaining batch means over the square of how many
+// remain.  A steady state has been reached once there are at least
+// WARMUP_MIN_BATCHES batches and the truncation point falls in the first
+// half; values are kept for at most WARMUP_MAX_RUNS runs.
+
+#define WARMUP_BATCH       5
+#define WARMUP_MIN_BATCHES 4
+#define WARMUP_MAX_RUNS    4096
+
+struct warmup {
+    double *batches; // batch means
+    int nbatches;
+    int n;           // values added
+    double sum;      // of the current batch so far
+};
+
+#define warmup_init() {NULL, 0, 0, 0}
+
+int warmup_setup(struct warmup *w, struct error_buffer *errbuf);
+
+// Adds a value, returns 0 if it couldn't be kept as WARMUP_MAX_RUNS have
+// been added already.
+int warmup_add(struct warmup *w, int64_t v);
+
+// The number of leading runs that are warm-up, or -1 if no steady state
+// has been reached yet.
+int warmup_truncation(const struct warmup *w);
+
+// Like warmup_truncation(), but with whatever values there are, e.g.
+// when sampling has ended; 0 if there are too few to tell.
+int warmup_best_truncation(const struct warmup *w);
+
+#endif // _WARMUP_H